@@ -2,6 +2,9 @@
 #include <math.h>
 #include "msp.h"
 #include "LSM9DS1.h"
+#include "profile.h"
+#include "spi.h"
+#include "scheduler.h"
 
 // available eUSCI_B1 pins (all primary pin function, so SEL must be changed):
 // P6.2 - UCB1STE      bottom of board      slave select
@@ -13,6 +16,15 @@
 // 6.0 - CSAG
 // 6.1 - CSM
 
+SPI_DEFINE(sensorBus, EUSCI_B1)     // polled, every transfer is a handful of bytes
+#define CS_AG   (BIT0 | BIT2)       // pins driven low for each subchip
+#define CS_M    (BIT1 | BIT2)
+
+// the unit on these pins, the one the LSM9DS1_ calls without a handle use. opened by LSM9DS1_InitFrom()
+struct lsm9ds1_t LSM9DS1_Board;
+
+// GPIO P6.6 is the INT1_A/G input, active high push-pull
+
 // peripheral pin definitions (all level shifted so you can use 3-5V logic in and has 3V logic out):
 // SCL      - SPI clock pin.                            SPC in the datasheet.
 // SDA      - SPI MOSI pin.                             SDI/SDO in the datasheet.
@@ -102,14 +114,31 @@
 #define INT_THS_L           0x32   // W  - Magnetometer interrupt threshold low byte. See datasheet page 68
 #define INT_THS_H           0x33   // W  - Magnetometer interrupt threshold high byte. See datasheet page 68
 
-uint16_t RDxBuffer = 0;
+#define WHO_AM_I_AG_VALUE   0x68   // what WHO_AM_I returns on the AG subchip
+#define WHO_AM_I_M_VALUE    0x3D   // what WHO_AM_I_M returns on the M subchip
+
+// UCB1 is clocked from SMCLK, which is 12 MHz after Clock_Init48MHz(), and fBitClock = 12 MHz / divider.
+// the LSM9DS1 is rated for a 10 MHz SPI clock, so 2 (6 MHz) is the fastest allowed. Init tries these
+// in order and keeps the first one where both WHO_AM_I registers read back correctly, in case the
+// wiring or the breakout's level shifters can't keep up
+static const uint16_t busDividers[] = {LSM9DS1_SPI_DIVIDER, 3, 6, 12, 120};
+static uint16_t busDivider = 0;
 
-void LSM9DS1_Init(void){
+// returns the divider that works, or 0 if the sensor never answered
+uint16_t LSM9DS1_Init(void){
+    return LSM9DS1_InitFrom(0);
+};
+
+// Same as LSM9DS1_Init(), but from a state saved by LSM9DS1_GetState() (e.g. kept in flash) when
+// state isn't 0: its bus divider is tried before searching for one, and its calibration is applied
+// so nothing has to be recalibrated after a reset. The configuration always starts as LSM9DS1_PROFILE_DEFAULT
+uint16_t LSM9DS1_InitFrom(const struct lsm9ds1_state_t *state){
+    uint8_t i;
 
     // pin init
     P6SEL0 |= (BIT2 | BIT3 | BIT4 | BIT5); // configure P9.2-P9.5 as primary module function
     P6DIR |= (BIT0 | BIT1 | BIT2); // make P9.0 and P9.1 outputs for the two SS pins
-    P6OUT |= (BIT0 | BIT1 | BIT2); // deassert both CS pins
+    LSM9DS1_DevOpen(&LSM9DS1_Board, &P6OUT, CS_AG, CS_M);  // deasserts both CS pins
 
     // UCB1 init
     EUSCI_B1->CTLW0 |= EUSCI_B_CTLW0_SWRST; // Put state machine in reset
@@ -120,19 +149,66 @@ void LSM9DS1_Init(void){
                      EUSCI_B_CTLW0_MODE_1 | // 4-pin mode
                        EUSCI_B_CTLW0_STEM | // STE mode select
                        EUSCI_B_CTLW0_CKPH | // clock phase select. fuck yeah, im still unsure what this does, but it made it work :)
-                  EUSCI_B_CTLW0_SSEL__ACLK; // ACLK
-    EUSCI_B1->BRW = 1;  //fBitClock = fBRCLK/(UCBRx+1)
+                 EUSCI_B_CTLW0_SSEL__SMCLK; // SMCLK (12 MHz)
+    EUSCI_B1->BRW = 120;  //fBitClock = fBRCLK/UCBRx, start slow (100 kHz) until the sensor has answered
     EUSCI_B1->CTLW0 &= ~EUSCI_B_CTLW0_SWRST; // Enable eUSCI_B SPI
+
+    // find the fastest bus speed the sensor answers at, starting with the one that worked last time
+    busDivider = 0;
+    if ((state != 0) && (state->busDivider != 0)) {
+        LSM9DS1_SetBusDivider(state->busDivider);
+        if (!LSM9DS1_CheckID()) {
+            busDivider = 0;
+        }
+    }
+    for (i = 0; (busDivider == 0) && (i < (sizeof(busDividers) / sizeof(busDividers[0]))); i++) {
+        LSM9DS1_SetBusDivider(busDividers[i]);
+        if (LSM9DS1_CheckID()) {
+            break;
+        }
+        busDivider = 0;
+    }
+    if (busDivider == 0) {
+        return 0;   // nothing answered, leave the sensor alone
+    }
     
-    // LSM init
-    write_SPI(AG, CTRL_REG1_G, 0x20);   // enable gyro  @ 14.9hz
-    write_SPI(AG, CTRL_REG6_XL, 0x40);  // enable accel @ 50hz
-    write_SPI(AG, CTRL_REG5_XL, 0x38);  // enable accel output, was supposed to default to this, but didnt
-    write_SPI(M, CTRL_REG3_M, 0x00);    // disable i2c, enable spi write operations, continuous conversion
-    write_SPI(M, CTRL_REG1_M, 0x74);    // XY axis ultra-high performance mode (since this is wired so battery life isnt a concern) and 20Hz output rate
-    write_SPI(M, CTRL_REG4_M, 0x0C);    // Z axis ultra-high performance mode (for the same reason)
+    LSM9DS1_DevInit(&LSM9DS1_Board, 0, (state != 0) ? &state->cal : 0);
+    return busDivider;
+};
+
+// everything LSM9DS1_InitFrom() needs to bring the sensor back up the way it is now
+void LSM9DS1_GetState(struct lsm9ds1_state_t *state){
+    state->busDivider = busDivider;
+    LSM9DS1_GetCalibration(&state->cal);
+};
+
+// sets the UCB1 clock divider, fBitClock = 12 MHz / divider. Values under 2 are raised to 2
+// since 12 MHz is over the sensor's limit. returns the divider now in use
+uint16_t LSM9DS1_SetBusDivider(uint16_t divider){
+    if (divider < 2) {
+        divider = 2;
+    }
+    EUSCI_B1->CTLW0 |= EUSCI_B_CTLW0_SWRST;     // BRW can only be changed in reset
+    EUSCI_B1->BRW = divider;
+    EUSCI_B1->CTLW0 &= ~EUSCI_B_CTLW0_SWRST;
+    busDivider = divider;
+    return divider;
+};
+
+uint16_t LSM9DS1_GetBusDivider(void){
+    return busDivider;
+};
+
+// true if both subchips of dev return their WHO_AM_I value at the current bus speed
+uint8_t LSM9DS1_DevCheckID(struct lsm9ds1_t *dev){
+    return (LSM9DS1_DevWHO_AM_I(dev, AG) == WHO_AM_I_AG_VALUE) && (LSM9DS1_DevWHO_AM_I(dev, M) == WHO_AM_I_M_VALUE);
+};
+
+uint8_t LSM9DS1_CheckID(void){
+    return LSM9DS1_DevCheckID(&LSM9DS1_Board);
 };
 
+// one byte at a time with no CS and a BUSY wait after each, kept for bench_main.c to compare against
 uint8_t SPI_transfer(uint8_t data){
 
     // begin transmission
@@ -145,140 +221,969 @@ uint8_t SPI_transfer(uint8_t data){
     return EUSCI_B1->RXBUF;
 }
 
-// if bytesToRead is 2, will read 2 bytes, otherwise it will read 1
-void read_SPI(enum ss_t device, uint8_t address, uint8_t bytesToRead){
-    if (device == AG) {
-        P6OUT &= (~BIT0 & ~BIT2); // assert CSAG
-        SPI_transfer(address | 0x80);
-    } else if (device == M) {
-        P6OUT &= (~BIT1 & ~BIT2); // assert CSM
-        SPI_transfer(address | 0xC0);
+// one CS window on a subchip of dev: the address byte, then tx out or rx in. the time it held
+// the bus and the bytes it moved go into dev's counters for LSM9DS1_DevBusReport()
+static void transact(struct lsm9ds1_t *dev, enum ss_t device, uint8_t address, const uint8_t *tx, uint16_t txCount, uint8_t *rx, uint16_t rxCount){
+    struct spi_txn_t txn = {0};
+    uint32_t start = DWT->CYCCNT;
+
+    txn.csPort = dev->csPort;
+    txn.csMask = (device == M) ? dev->csM : dev->csAG;
+    txn.header = address;
+    txn.headerLength = 1;
+    txn.tx = tx;
+    txn.txCount = txCount;
+    txn.rx = rx;
+    txn.rxCount = rxCount;
+    sensorBus_Run(&txn);
+    dev->busCycles += DWT->CYCCNT - start;
+    dev->busBytes += 1 + txCount + rxCount;
+}
+
+// reads bytesToRead consecutive registers starting at address into data, all in one CS window.
+// AG relies on CTRL_REG8 IF_ADD_INC, M uses the 0x40 auto increment bit in the address byte.
+// the caller owns data, so nothing is shared between callers except the bus itself
+// (a transaction still must not be started while another one is in progress)
+static void devRead(struct lsm9ds1_t *dev, enum ss_t device, uint8_t address, uint8_t *data, uint16_t bytesToRead){
+    uint32_t start = PROFILE_START();
+
+    transact(dev, device, address | ((device == M) ? 0xC0 : 0x80), 0, 0, data, bytesToRead);
+    // PORT6_IRQHandler and main both read and Profile_Record() isn't atomic, so each level gets its own scope
+    PROFILE_STOP((SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) ? PROFILE_READ_SPI_ISR : PROFILE_READ_SPI_MAIN, start);
+}
+
+// reads a two's complement L/H output pair with one transaction
+static int16_t devReadInt16(struct lsm9ds1_t *dev, enum ss_t device, uint8_t address){
+    uint8_t raw[2];
+    devRead(dev, device, address, raw, 2);
+    return (int16_t)((raw[1] << 8) | raw[0]);
+}
+
+static void devWrite(struct lsm9ds1_t *dev, enum ss_t device, uint8_t address, uint8_t data){
+    transact(dev, device, address, &data, 1, 0, 0);
+}
+
+// writes count consecutive registers starting at address in one CS window, auto incrementing like devRead
+static void devWriteBurst(struct lsm9ds1_t *dev, enum ss_t device, uint8_t address, const uint8_t *data, uint16_t count){
+    transact(dev, device, (device == M) ? (address | 0x40) : address, data, count, 0, 0);
+}
+
+// read-modify-write of one register: clears the clear bits, then sets the set bits
+static void devModify(struct lsm9ds1_t *dev, enum ss_t device, uint8_t address, uint8_t clear, uint8_t set){
+    uint8_t reg;
+    devRead(dev, device, address, &reg, 1);
+    devWrite(dev, device, address, (reg & ~clear) | set);
+}
+
+// devRead() on LSM9DS1_Board, for bench_main.c
+void read_SPI(enum ss_t device, uint8_t address, uint8_t *data, uint16_t bytesToRead){
+    devRead(&LSM9DS1_Board, device, address, data, bytesToRead);
+}
+
+// Keeps the INT1 handler (the acquisition ISR) off the bus while a main loop call is using it.
+// P6IFG still latches an edge that comes in meanwhile, so that interrupt just runs a little late.
+// every unit's INT1 is expected to be on P6.6 (wired-OR) or serviced from the same handler
+static uint8_t busLock(void){
+    uint8_t wasEnabled = (P6IE & BIT6) != 0;
+    P6IE &= ~BIT6;
+    return wasEnabled;
+}
+
+static void busUnlock(uint8_t wasEnabled){
+    if (wasEnabled) {
+        P6IE |= BIT6;
     }
+}
+
+uint16_t LSM9DS1_DevWHO_AM_I(struct lsm9ds1_t *dev, enum ss_t device){
+    uint8_t id;
+    devRead(dev, device, WHO_AM_I, &id, 1);
+    return id;
+};
+
+uint16_t LSM9DS1_WHO_AM_I(enum ss_t device){
+    return LSM9DS1_DevWHO_AM_I(&LSM9DS1_Board, device);
+};
+
+// used during testing/debugging
+uint16_t LSM9DS1_TEST_CMD(void){
+    uint8_t reg;
+    read_SPI(AG, CTRL_REG5_XL, &reg, 1);
+    return reg;
+};
+
+// Conversion constants, sensitivity * 2^32 so that raw * k >> 16 is the value in Q16.16.
+// k fits an int32 for anything under 0.5 units/LSB and the product is a 64 bit SMULL, so any raw value
+// from -32768 to 32767 converts without overflow, with one multiply and shift and no division
+// the A, G and M tables are indexed by the FS field value of enum fs_xl_t, fs_g_t and fs_m_t.
+// see datasheet page 12
+static const int32_t kATable[4] = {
+    261993,     // +-2 g,  0.061 mg/LSB
+    3143916,    // +-16 g, 0.732 mg/LSB
+    523986,     // +-4 g,  0.122 mg/LSB
+    1047972     // +-8 g,  0.244 mg/LSB
+};
+static const int32_t kGTable[4] = {
+    37580964,   // 245 dps,  8.75 mdps/LSB
+    75161928,   // 500 dps,  17.5 mdps/LSB
+    300647711,  // not available, treated as 2000 dps
+    300647711   // 2000 dps, 70 mdps/LSB
+};
+static const int32_t kMTable[4] = {
+    601295,     // +-4 gauss,  0.14 mgauss/LSB
+    1245541,    // +-8 gauss,  0.29 mgauss/LSB
+    1846836,    // +-12 gauss, 0.43 mgauss/LSB
+    2491081     // +-16 gauss, 0.58 mgauss/LSB
+};
+#define K_TMP   268435456   // 16 LSB/C (C), see datasheet page 14
+#define TMP_OFFSET (25 * Q16_ONE)   // the temperature output reads 0 at 25 C
+
+// the calibration a unit starts out with, no correction
+static const struct lsm9ds1_cal_t calNone = {
+    {0, 0, 0}, {Q16_ONE, Q16_ONE, Q16_ONE}, {0, 0, 0}, {0, 0, 0}
+};
 
-    RDxBuffer = (0x0000 | SPI_transfer(0));     // read first byte and put into global var
+// Writes the hard-iron offset to OFFSET_X/Y/Z_REG_M, the M die then subtracts it from every output itself.
+// the registers count in output LSBs, so this is redone whenever the mag full scale changes
+static void writeMagOffsets(struct lsm9ds1_t *dev){
+    uint8_t i;
+    int32_t lsb;
+    uint8_t regs[6];
 
-    if (bytesToRead == 2){
-        RDxBuffer = (SPI_transfer(0) << 8) | RDxBuffer; // read second byte and put into global var
+    for (i = 0; i < 3; i++) {
+        lsb = (int32_t)(((int64_t)dev->cal.magOffset[i] << 16) / dev->kM);
+        if (lsb > 32767) {
+            lsb = 32767;
+        } else if (lsb < -32768) {
+            lsb = -32768;
+        }
+        regs[2 * i] = lsb & 0xFF;
+        regs[2 * i + 1] = (lsb >> 8) & 0xFF;
     }
+    devWriteBurst(dev, M, OFFSET_X_REG_L_M, regs, 6);  // X, Y, Z L/H in one go
+};
+
+// out[i] = raw[i] * k / 2^16, rounded
+static void convert(const int16_t *raw, q16_t *out, uint16_t count, int32_t k){
+    uint16_t i;
+    for (i = 0; i < count; i++) {
+        out[i] = (q16_t)((((int64_t)raw[i] * k) + 0x8000) >> 16);
+    }
+};
 
-    if (device == AG) {
-        P6OUT |= (BIT0 | BIT2); // deassert CSAG
+// Converts count raw outputs of one device (A, G or M) to Q16.16 g, dps or gauss.
+// raw can be a whole block, e.g. every axis of a batch of FIFO samples laid end to end.
+// the software calibration (biases, soft-iron scale) is per axis, so it isn't applied here
+void LSM9DS1_DevConvert(struct lsm9ds1_t *dev, const int16_t *raw, q16_t *out, uint16_t count, enum ss_t device){
+    if (device == A) {
+        convert(raw, out, count, dev->kA);
+    } else if (device == G) {
+        convert(raw, out, count, dev->kG);
     } else if (device == M) {
-        P6OUT |= (BIT1 | BIT2); // deassert CSM
+        convert(raw, out, count, dev->kM);
+    }
+};
+
+void LSM9DS1_Convert(const int16_t *raw, q16_t *out, uint16_t count, enum ss_t device){
+    LSM9DS1_DevConvert(&LSM9DS1_Board, raw, out, count, device);
+};
+
+// all of an AG sample, temperature included, with the gyro and accel biases taken out
+void LSM9DS1_DevConvertAG(struct lsm9ds1_t *dev, const struct ag_sample_t *raw, struct ag_value_t *out){
+    out->temp = LSM9DS1_ScaleTMP(raw->temp);
+    convert(&raw->gx, &out->gx, 3, dev->kG);
+    convert(&raw->ax, &out->ax, 3, dev->kA);
+    out->gx -= dev->cal.gyroBias[0];
+    out->gy -= dev->cal.gyroBias[1];
+    out->gz -= dev->cal.gyroBias[2];
+    out->ax -= dev->cal.accelBias[0];
+    out->ay -= dev->cal.accelBias[1];
+    out->az -= dev->cal.accelBias[2];
+};
+
+void LSM9DS1_ConvertAG(const struct ag_sample_t *raw, struct ag_value_t *out){
+    LSM9DS1_DevConvertAG(&LSM9DS1_Board, raw, out);
+};
+
+// the hard-iron offset is already out (the chip does it), this applies the soft-iron scale
+void LSM9DS1_DevConvertM(struct lsm9ds1_t *dev, const struct m_sample_t *raw, struct m_value_t *out){
+    convert(&raw->mx, &out->mx, 3, dev->kM);
+    out->mx = (q16_t)(((int64_t)out->mx * dev->cal.magScale[0]) >> 16);
+    out->my = (q16_t)(((int64_t)out->my * dev->cal.magScale[1]) >> 16);
+    out->mz = (q16_t)(((int64_t)out->mz * dev->cal.magScale[2]) >> 16);
+};
+
+void LSM9DS1_ConvertM(const struct m_sample_t *raw, struct m_value_t *out){
+    LSM9DS1_DevConvertM(&LSM9DS1_Board, raw, out);
+};
+
+// single value versions of the above, in g, dps, gauss and C. they don't know the axis, so no calibration
+q16_t LSM9DS1_ScaleA(int16_t raw){
+    q16_t out;
+    convert(&raw, &out, 1, LSM9DS1_Board.kA);
+    return out;
+};
+
+q16_t LSM9DS1_ScaleG(int16_t raw){
+    q16_t out;
+    convert(&raw, &out, 1, LSM9DS1_Board.kG);
+    return out;
+};
+
+q16_t LSM9DS1_ScaleM(int16_t raw){
+    q16_t out;
+    convert(&raw, &out, 1, LSM9DS1_Board.kM);
+    return out;
+};
+
+q16_t LSM9DS1_ScaleTMP(int16_t raw){
+    q16_t out;
+    convert(&raw, &out, 1, K_TMP);
+    return out + TMP_OFFSET;
+};
+
+// Q16.16 to an integer count of 1/multiplier units, rounded, e.g. multiplier 10 for 1 decimal place
+int32_t LSM9DS1_Q16ToFixed(q16_t value, int32_t multiplier){
+    return (int32_t)((((int64_t)value * multiplier) + 0x8000) >> 16);
+};
+
+q16_t LSM9DS1_XA(void){
+    return LSM9DS1_ScaleA(devReadInt16(&LSM9DS1_Board, AG, OUT_X_L_XL));
+};
+
+q16_t LSM9DS1_YA(void){
+    return LSM9DS1_ScaleA(devReadInt16(&LSM9DS1_Board, AG, OUT_Y_L_XL));
+};
+
+q16_t LSM9DS1_ZA(void){
+    return LSM9DS1_ScaleA(devReadInt16(&LSM9DS1_Board, AG, OUT_Z_L_XL));
+};
+
+q16_t LSM9DS1_XG(void){
+    return LSM9DS1_ScaleG(devReadInt16(&LSM9DS1_Board, AG, OUT_X_L_G));
+};
+
+q16_t LSM9DS1_YG(void){
+    return LSM9DS1_ScaleG(devReadInt16(&LSM9DS1_Board, AG, OUT_Y_L_G));
+};
+
+q16_t LSM9DS1_ZG(void){
+    return LSM9DS1_ScaleG(devReadInt16(&LSM9DS1_Board, AG, OUT_Z_L_G));
+};
+
+q16_t LSM9DS1_XM(void){
+    return LSM9DS1_ScaleM(devReadInt16(&LSM9DS1_Board, M, OUT_X_L_M));
+};
+
+q16_t LSM9DS1_YM(void){
+    return LSM9DS1_ScaleM(devReadInt16(&LSM9DS1_Board, M, OUT_Y_L_M));
+};
+
+q16_t LSM9DS1_ZM(void){
+    return LSM9DS1_ScaleM(devReadInt16(&LSM9DS1_Board, M, OUT_Z_L_M));
+};
+
+// Temperature sensor output data. 
+// The value is expressed as two’s complement sign extended on the MSB
+q16_t LSM9DS1_TMP(void){
+    return LSM9DS1_ScaleTMP(devReadInt16(&LSM9DS1_Board, AG, OUT_TEMP_L));
+};
+
+// Reads temperature, gyro and accel raw outputs with 2 transactions. OUT_TEMP_L..OUT_Z_H_G (0x15-0x1D)
+// are contiguous but for STATUS_REG_0 in the middle, so that block comes into a local and is unpacked.
+// the accel registers are little endian L/H pairs, same as the Cortex-M, and ax..az are laid out in
+// the struct in register order, so OUT_X_L_XL..OUT_Z_H_XL (0x28-0x2D) burst-reads directly into them.
+// reading straight through 0x15-0x2D in one window would clock 10 unused control/status bytes
+void LSM9DS1_DevReadAGBurst(struct lsm9ds1_t *dev, struct ag_sample_t *sample){
+    uint8_t raw[9];
+
+    devRead(dev, AG, OUT_TEMP_L, raw, 9);    // temp L/H, STATUS_REG_0, gyro X/Y/Z L/H
+    sample->temp = (int16_t)((raw[1] << 8) | raw[0]);
+    sample->gx   = (int16_t)((raw[4] << 8) | raw[3]);
+    sample->gy   = (int16_t)((raw[6] << 8) | raw[5]);
+    sample->gz   = (int16_t)((raw[8] << 8) | raw[7]);
+    devRead(dev, AG, OUT_X_L_XL, (uint8_t *)&sample->ax, 6); // accel X/Y/Z L/H
+};
+
+void LSM9DS1_ReadAGBurst(struct ag_sample_t *sample){
+    LSM9DS1_DevReadAGBurst(&LSM9DS1_Board, sample);
+};
+
+// Reads all three magnetometer axes in one transaction. all zero while the mag is still settling
+// after a wake, which Fusion_Update() takes as no mag reading
+void LSM9DS1_DevReadMBurst(struct lsm9ds1_t *dev, struct m_sample_t *sample){
+    if (dev->mSettle > 0) {
+        sample->mx = 0;
+        sample->my = 0;
+        sample->mz = 0;
+        return;
+    }
+    devRead(dev, M, OUT_X_L_M, (uint8_t *)&sample->mx, 6);
+};
+
+void LSM9DS1_ReadMBurst(struct m_sample_t *sample){
+    LSM9DS1_DevReadMBurst(&LSM9DS1_Board, sample);
+};
+
+// FIFO_CTRL fields. See datasheet page 56
+#define FIFO_CTRL_FMODE_SHIFT   5
+#define FIFO_CTRL_FTH_MASK      0x1F
+// CTRL_REG9 fields. See datasheet page 54
+#define CTRL_REG9_SLEEP_G       0x40
+#define CTRL_REG9_FIFO_EN       0x02
+// FIFO_SRC fields. See datasheet page 57
+#define FIFO_SRC_FTH            0x80   // at or above the watermark
+#define FIFO_SRC_OVRN           0x40   // overwritten (continuous) or full (FIFO mode)
+#define FIFO_SRC_FSS_MASK       0x3F   // number of unread samples, 0-32
+
+// Sets up the 32 sample AG FIFO. Each slot holds one gyro and one accel sample, taken at the gyro ODR
+// while the gyro is on. watermark (0-31) is the level that raises FIFO_SRC FTH (and INT_FTH if routed).
+// FIFO_BYPASS turns it back off, which also empties it
+void LSM9DS1_DevFIFOInit(struct lsm9ds1_t *dev, enum fifo_mode_t mode, uint8_t watermark){
+    devWrite(dev, AG, FIFO_CTRL, FIFO_BYPASS << FIFO_CTRL_FMODE_SHIFT);   // bypass first, restarts the FIFO
+    if (mode == FIFO_BYPASS) {
+        devModify(dev, AG, CTRL_REG9, CTRL_REG9_FIFO_EN, 0);
+        return;
+    }
+    devModify(dev, AG, CTRL_REG9, 0, CTRL_REG9_FIFO_EN);
+    devWrite(dev, AG, FIFO_CTRL, (mode << FIFO_CTRL_FMODE_SHIFT) | (watermark & FIFO_CTRL_FTH_MASK));
+};
+
+void LSM9DS1_FIFOInit(enum fifo_mode_t mode, uint8_t watermark){
+    LSM9DS1_DevFIFOInit(&LSM9DS1_Board, mode, watermark);
+};
+
+// raw FIFO_SRC, see the FIFO_SRC_ fields. the low 6 bits are the number of unread samples
+uint8_t LSM9DS1_DevFIFOStatus(struct lsm9ds1_t *dev){
+    uint8_t src;
+    devRead(dev, AG, FIFO_SRC, &src, 1);
+    return src;
+};
+
+uint8_t LSM9DS1_FIFOStatus(void){
+    return LSM9DS1_DevFIFOStatus(&LSM9DS1_Board);
+};
+
+// Drains up to maxSamples FIFO slots, oldest first, into samples. returns how many were read.
+// FIFO_SRC is read once and then every unread slot is pulled back to back, 2 * count + 1
+// transactions in all. A slot can't be read in one window, let alone a batch: its gyro half
+// (0x18-0x1D) and accel half (0x28-0x2D) sit 10 control/status registers apart, and IF_ADD_INC
+// walks on through the register map rather than wrapping back to OUT_X_L_G for the next slot.
+// Clocking the 10 registers in between costs more than the second window's address byte, so each
+// slot is a gyro and an accel burst. The temperature isn't part of the FIFO, it comes in with the
+// first slot's gyro (like LSM9DS1_DevReadAGBurst()) and is copied into every sample of the batch.
+// Slots taken while a woken part was still settling are read (to empty the FIFO) but not returned
+uint8_t LSM9DS1_DevReadFIFO(struct lsm9ds1_t *dev, struct ag_sample_t *samples, uint8_t maxSamples){
+    uint8_t count, i, drop;
+
+    count = LSM9DS1_DevFIFOStatus(dev) & FIFO_SRC_FSS_MASK;
+    if (count > maxSamples) {
+        count = maxSamples;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    LSM9DS1_DevReadAGBurst(dev, &samples[0]);
+    for (i = 1; i < count; i++) {
+        devRead(dev, AG, OUT_X_L_G, (uint8_t *)&samples[i].gx, 6);
+        devRead(dev, AG, OUT_X_L_XL, (uint8_t *)&samples[i].ax, 6);
+        samples[i].temp = samples[0].temp;
     }
+    dev->mSettle = (dev->mSettle > count) ? (dev->mSettle - count) : 0;
+    if (dev->agSettle > 0) {
+        drop = (dev->agSettle < count) ? dev->agSettle : count;
+        dev->agSettle -= drop;
+        for (i = drop; i < count; i++) {
+            samples[i - drop] = samples[i];
+        }
+        count -= drop;
+    }
+    return count;
+};
+
+uint8_t LSM9DS1_ReadFIFO(struct ag_sample_t *samples, uint8_t maxSamples){
+    return LSM9DS1_DevReadFIFO(&LSM9DS1_Board, samples, maxSamples);
+};
+
+// Routes the LSM9DS1_INT1_ sources to dev's INT1_A/G pin, 0 for none. where that pin goes is the board's
+// business, LSM9DS1_EnableInt1() also arms P6.6 for LSM9DS1_Board
+void LSM9DS1_DevEnableInt1(struct lsm9ds1_t *dev, uint8_t sources){
+    uint8_t lock = busLock();
+    devWrite(dev, AG, INT1_CTRL, sources);
+    busUnlock(lock);
+};
+
+// Routes the LSM9DS1_INT1_ sources to the INT1_A/G pin and arms a rising edge interrupt on P6.6 for it.
+// PORT6_IRQHandler has to clear P6IFG BIT6 and service whatever raised it. Level sources (DRDY, FTH)
+// stay high until they are serviced, so a handler that finds LSM9DS1_Int1Active() still true should go again
+// rather than wait for an edge that won't come. 0 turns the pin and the interrupt off
+void LSM9DS1_EnableInt1(uint8_t sources){
+    P6IE &= ~BIT6;          // quiet while it is being set up
+    devWrite(&LSM9DS1_Board, AG, INT1_CTRL, sources);
+    if (sources == 0) {
+        return;
+    }
+    P6SEL0 &= ~BIT6;        // GPIO
+    P6SEL1 &= ~BIT6;
+    P6DIR  &= ~BIT6;        // input, the sensor drives it
+    P6REN  &= ~BIT6;
+    P6IES  &= ~BIT6;        // rising edge
+    P6IFG  &= ~BIT6;
+    P6IE   |=  BIT6;
+    NVIC->ISER[1] |= 0x100; // enable the port 6 interrupt (IRQ 40)
+};
+
+// true while the INT1_A/G pin is high
+uint8_t LSM9DS1_Int1Active(void){
+    return (P6IN & BIT6) != 0;
+};
+
+// ODR/FS/BW field positions. See datasheet pages 45, 52, 63-65
+#define CTRL_REG1_G_ODR_SHIFT   5
+#define CTRL_REG1_G_FS_SHIFT    3
+#define CTRL_REG6_XL_ODR_SHIFT  5
+#define CTRL_REG6_XL_FS_SHIFT   3
+#define CTRL_REG6_XL_BW_SCAL    0x04   // use BW_XL instead of the bandwidth picked by the ODR
+#define CTRL_REG1_M_OM_SHIFT    5
+#define CTRL_REG1_M_DO_SHIFT    2
+#define CTRL_REG2_M_FS_SHIFT    5
+#define CTRL_REG4_M_OMZ_SHIFT   2
+
+// what Init sets up. the wired board doesn't care much about battery life, so the mag runs ultra-high performance
+const struct lsm9ds1_config_t LSM9DS1_PROFILE_DEFAULT = {
+    ODR_G_14_9,  FS_G_245,  0,
+    ODR_XL_50,   FS_XL_2G,  LSM9DS1_XL_BW_AUTO,
+    ODR_M_20,    FS_M_4,    OM_M_ULTRA_HIGH,
+    MD_M_CONTINUOUS
+};
+// everything flat out with the widest ranges, for vibration capture. drain the FIFO with a high watermark
+const struct lsm9ds1_config_t LSM9DS1_PROFILE_VIBRATION = {
+    ODR_G_952,   FS_G_2000, 3,
+    ODR_XL_952,  FS_XL_16G, LSM9DS1_XL_BW_AUTO,
+    ODR_M_80,    FS_M_16,   OM_M_LOW_POWER,  // 80Hz with the widest range, the mag isn't the point here
+    MD_M_CONTINUOUS
+};
+// gyro off (it is most of the sensor's current), slow accel and mag, for battery operation
+const struct lsm9ds1_config_t LSM9DS1_PROFILE_LOW_POWER = {
+    ODR_G_OFF,   FS_G_245,  0,
+    ODR_XL_10,   FS_XL_2G,  LSM9DS1_XL_BW_AUTO,
+    ODR_M_0_625, FS_M_4,    OM_M_LOW_POWER,
+    MD_M_CONTINUOUS
+};
+
+// everything off, what a unit is assumed to be at when it is opened, so the first Configure()
+// switches everything on and lets it settle
+static const struct lsm9ds1_config_t configOff = {
+    ODR_G_OFF,   FS_G_245,  0,
+    ODR_XL_OFF,  FS_XL_2G,  LSM9DS1_XL_BW_AUTO,
+    ODR_M_0_625, FS_M_4,    OM_M_LOW_POWER,
+    MD_M_OFF
+};
+
+static uint16_t settleSlots(struct lsm9ds1_t *dev, uint32_t ms);
+static void settleWoken(struct lsm9ds1_t *dev, uint8_t parts);
+
+// CTRL_REG1_G and CTRL_REG6_XL from config, with both ODRs 0 while the A/G subchip is powered down
+static void writeAGControl(struct lsm9ds1_t *dev, const struct lsm9ds1_config_t *config){
+    uint8_t reg1, reg6;
+
+    reg1 = (config->gyroScale << CTRL_REG1_G_FS_SHIFT) | (config->gyroBandwidth & 0x03);
+    reg6 = config->accelScale << CTRL_REG6_XL_FS_SHIFT;
+    if (config->accelBandwidth != LSM9DS1_XL_BW_AUTO) {
+        reg6 |= CTRL_REG6_XL_BW_SCAL | (config->accelBandwidth & 0x03);
+    }
+    if (!(dev->poweredDown & LSM9DS1_ACCEL)) {
+        reg1 |= config->gyroRate << CTRL_REG1_G_ODR_SHIFT;
+        reg6 |= config->accelRate << CTRL_REG6_XL_ODR_SHIFT;
+    }
+    devWrite(dev, AG, CTRL_REG1_G, reg1);
+    devWrite(dev, AG, CTRL_REG6_XL, reg6);
 }
 
-void write_SPI(enum ss_t device, uint8_t address, uint8_t data){
-    if (device == AG) {
-        P6OUT &= (~BIT0 & ~BIT2); // assert CSAG
-        SPI_transfer(address);
-    } else if (device == M) {
-        P6OUT &= (~BIT1 & ~BIT2); // assert CSM
-        SPI_transfer(address);
+// Writes the rate, range and bandwidth of all three sensors and switches the conversion
+// constants to the new full scales, so converted values stay in g, dps and gauss.
+// With the gyro on, the accel runs at the gyro's ODR and accelRate is ignored by the sensor.
+// ODR_G_OFF and MD_M_OFF power the gyro and magnetometer down, the accel has to stay on
+// (ODR_XL_OFF with the gyro off stops the FIFO and with it all acquisition). Parts held down
+// by LSM9DS1_PowerDown() stay down, parts this switches on settle like after LSM9DS1_PowerUp()
+void LSM9DS1_DevConfigure(struct lsm9ds1_t *dev, const struct lsm9ds1_config_t *config){
+    uint8_t regM[2];
+    uint8_t switchedOn = 0;
+    uint8_t lock = busLock();
+
+    if ((dev->config.gyroRate == ODR_G_OFF) && (config->gyroRate != ODR_G_OFF)) {
+        switchedOn |= LSM9DS1_GYRO;
+    }
+    if ((dev->config.accelRate == ODR_XL_OFF) && (config->accelRate != ODR_XL_OFF)) {
+        switchedOn |= LSM9DS1_ACCEL;
     }
+    if ((dev->config.magPower == MD_M_OFF) && (config->magPower != MD_M_OFF)) {
+        switchedOn |= LSM9DS1_MAG;
+    }
+    writeAGControl(dev, config);
+    regM[0] = (config->magMode << CTRL_REG1_M_OM_SHIFT) | (config->magRate << CTRL_REG1_M_DO_SHIFT);
+    regM[1] = config->magScale << CTRL_REG2_M_FS_SHIFT;
+    devWriteBurst(dev, M, CTRL_REG1_M, regM, 2);   // CTRL_REG1_M and CTRL_REG2_M
+    devWrite(dev, M, CTRL_REG4_M, config->magMode << CTRL_REG4_M_OMZ_SHIFT);    // Z axis in the same mode as X and Y
+    // SPI writes stay on, I2C and SPI reads untouched
+    devWrite(dev, M, CTRL_REG3_M, (dev->poweredDown & LSM9DS1_MAG) ? MD_M_OFF : (config->magPower & 0x03));
+
+    dev->kA = kATable[config->accelScale & 0x03];
+    dev->kG = kGTable[config->gyroScale & 0x03];
+    dev->kM = kMTable[config->magScale & 0x03];
+    dev->config = *config;
+    writeMagOffsets(dev);  // same offset in gauss, new LSB size
+    settleWoken(dev, switchedOn & ~dev->poweredDown);
+    busUnlock(lock);
+};
 
-    SPI_transfer(data);
+void LSM9DS1_Configure(const struct lsm9ds1_config_t *config){
+    LSM9DS1_DevConfigure(&LSM9DS1_Board, config);
+};
 
-    if (device == AG) {
-        P6OUT |= (BIT0 | BIT2); // deassert CSAG
-    } else if (device == M) {
-        P6OUT |= (BIT1 | BIT2); // deassert CSM
+void LSM9DS1_DevGetConfig(struct lsm9ds1_t *dev, struct lsm9ds1_config_t *config){
+    *config = dev->config;
+};
+
+void LSM9DS1_GetConfig(struct lsm9ds1_config_t *config){
+    LSM9DS1_DevGetConfig(&LSM9DS1_Board, config);
+};
+
+// ODRs in mHz, indexed by enum odr_g_t / odr_xl_t
+static const uint32_t gyroRates[7] = {0, 14900, 59500, 119000, 238000, 476000, 952000};
+static const uint32_t accelRates[7] = {0, 10000, 50000, 119000, 238000, 476000, 952000};
+
+// the rate AG samples (and FIFO slots) come at, in mHz: the gyro's ODR while it is on, the accel's otherwise
+uint32_t LSM9DS1_DevSampleRate(struct lsm9ds1_t *dev){
+    if (dev->poweredDown & LSM9DS1_ACCEL) {
+        return 0;
     }
+    if ((dev->config.gyroRate != ODR_G_OFF) && (dev->config.gyroRate <= ODR_G_952)) {
+        return gyroRates[dev->config.gyroRate];
+    }
+    if (dev->config.accelRate <= ODR_XL_952) {
+        return accelRates[dev->config.accelRate];
+    }
+    return 0;
+};
+
+uint32_t LSM9DS1_SampleRate(void){
+    return LSM9DS1_DevSampleRate(&LSM9DS1_Board);
+};
+
+// Power gating. LSM9DS1_PowerDown() takes parts down without touching their configuration, so
+// LSM9DS1_PowerUp() brings them back exactly as they were. A part that comes back up isn't
+// trusted straight away: AG FIFO slots are dropped by LSM9DS1_ReadFIFO() for LSM9DS1_SETTLE_G_MS
+// after a gyro wake (LSM9DS1_SETTLE_XL_SLOTS after an accel wake), and LSM9DS1_ReadMBurst()
+// returns zeros for LSM9DS1_SETTLE_M_PERIODS magnetometer conversions
+
+// ODR_M values in mHz, indexed by enum odr_m_t
+static const uint32_t magRates[8] = {625, 1250, 2500, 5000, 10000, 20000, 40000, 80000};
+
+// AG slots that cover ms at the current sample rate, rounded up
+static uint16_t settleSlots(struct lsm9ds1_t *dev, uint32_t ms){
+    return (uint16_t)((ms * LSM9DS1_DevSampleRate(dev) + 999999) / 1000000);
 }
 
+static void settleWoken(struct lsm9ds1_t *dev, uint8_t parts){
+    uint16_t slots;
+
+    if (parts & LSM9DS1_ACCEL) {
+        slots = (dev->config.gyroRate != ODR_G_OFF) ? settleSlots(dev, LSM9DS1_SETTLE_G_MS) : LSM9DS1_SETTLE_XL_SLOTS;
+        dev->agSettle = (slots > dev->agSettle) ? slots : dev->agSettle;
+    }
+    if ((parts & LSM9DS1_GYRO) && (dev->config.gyroRate != ODR_G_OFF)) {
+        slots = settleSlots(dev, LSM9DS1_SETTLE_G_MS);
+        dev->agSettle = (slots > dev->agSettle) ? slots : dev->agSettle;
+    }
+    if ((parts & LSM9DS1_MAG) && (dev->config.magPower != MD_M_OFF)) {
+        slots = settleSlots(dev, (LSM9DS1_SETTLE_M_PERIODS * 1000000) / magRates[dev->config.magRate & 0x07]);
+        dev->mSettle = (slots > dev->mSettle) ? slots : dev->mSettle;
+    }
+}
 
+// takes the LSM9DS1_GYRO/ACCEL/MAG parts down, the rest keep running
+void LSM9DS1_DevPowerDown(struct lsm9ds1_t *dev, uint8_t parts){
+    uint8_t lock = busLock();
 
-uint16_t LSM9DS1_WHO_AM_I(enum ss_t device){
-    read_SPI(device, WHO_AM_I, 1);
-    return RDxBuffer;
+    parts &= ~dev->poweredDown;
+    dev->poweredDown |= parts;
+    if (parts & LSM9DS1_GYRO) {
+        devModify(dev, AG, CTRL_REG9, 0, CTRL_REG9_SLEEP_G);
+    }
+    if (parts & LSM9DS1_ACCEL) {
+        writeAGControl(dev, &dev->config);     // both ODRs 0 now
+    }
+    if (parts & LSM9DS1_MAG) {
+        devWrite(dev, M, CTRL_REG3_M, MD_M_OFF);
+    }
+    busUnlock(lock);
 };
 
-// used during testing/debugging
-uint16_t LSM9DS1_TEST_CMD(void){
-    read_SPI(AG, CTRL_REG5_XL, 1);
-    return RDxBuffer;
+void LSM9DS1_PowerDown(uint8_t parts){
+    LSM9DS1_DevPowerDown(&LSM9DS1_Board, parts);
 };
 
-// FIXME: find out how to convert this to a usable value
+// brings parts back up as they were configured and starts their settle time
+void LSM9DS1_DevPowerUp(struct lsm9ds1_t *dev, uint8_t parts){
+    uint8_t lock = busLock();
 
-int16_t LSM9DS1_XA(void){
-    read_SPI(AG, OUT_X_L_XL, 2);
-    // 0.061 mg per LSB (for the mode i specified). see datasheet page 12
-    int16_t accelX = (int16_t)RDxBuffer;
-    accelX = (accelX * 61) / 1000;
-    return accelX;
+    parts &= dev->poweredDown;
+    dev->poweredDown &= ~parts;
+    if (parts & LSM9DS1_ACCEL) {
+        writeAGControl(dev, &dev->config);
+    }
+    if (parts & LSM9DS1_GYRO) {
+        devModify(dev, AG, CTRL_REG9, CTRL_REG9_SLEEP_G, 0);
+    }
+    if (parts & LSM9DS1_MAG) {
+        devWrite(dev, M, CTRL_REG3_M, dev->config.magPower & 0x03);
+    }
+    settleWoken(dev, parts);
+    busUnlock(lock);
 };
 
-int16_t LSM9DS1_YA(void){
-    read_SPI(AG, OUT_Y_L_XL, 2);
-    // 0.061 mg per LSB (for the mode i specified). see datasheet page 12
-    int16_t accelY = (int16_t)RDxBuffer;
-    accelY = (accelY * 61) / 1000;
-    return accelY;
+void LSM9DS1_PowerUp(uint8_t parts){
+    LSM9DS1_DevPowerUp(&LSM9DS1_Board, parts);
 };
 
-int16_t LSM9DS1_ZA(void){
-    read_SPI(AG, OUT_Z_L_XL, 2);
-    // 0.061 mg per LSB (for the mode i specified). see datasheet page 12
-    int16_t accelZ = (int16_t)RDxBuffer;
-    accelZ = (accelZ * 61) / 1000;
-    return accelZ;
+uint8_t LSM9DS1_DevPoweredDown(struct lsm9ds1_t *dev){
+    return dev->poweredDown;
 };
 
-int16_t LSM9DS1_XG(void){
-    read_SPI(AG, OUT_X_L_G, 2);
-    // 8.75 mdps per LSB (for the mode i specified). see datasheet page 12
-    int16_t gyroX = (int16_t)RDxBuffer;
-    gyroX = (gyroX * 875) / 100;
-    return gyroX;
+uint8_t LSM9DS1_PoweredDown(void){
+    return LSM9DS1_DevPoweredDown(&LSM9DS1_Board);
 };
 
-int16_t LSM9DS1_YG(void){
-    read_SPI(AG, OUT_Y_L_G, 2);
-    // 8.75 mdps per LSB (for the mode i specified). see datasheet page 12
-    int16_t gyroY = (int16_t)RDxBuffer;
-    gyroY = (gyroY * 875) / 100;
-    return gyroY;
+// the parts whose output isn't trusted yet
+uint8_t LSM9DS1_DevSettling(struct lsm9ds1_t *dev){
+    return ((dev->agSettle > 0) ? (LSM9DS1_GYRO | LSM9DS1_ACCEL) : 0) | ((dev->mSettle > 0) ? LSM9DS1_MAG : 0);
 };
 
-int16_t LSM9DS1_ZG(void){
-    read_SPI(AG, OUT_Z_L_G, 2);
-    // 8.75 mdps per LSB (for the mode i specified). see datasheet page 12
-    int16_t gyroZ = (int16_t)RDxBuffer;
-    gyroZ = (gyroZ * 875) / 100;
-    return gyroZ;
+uint8_t LSM9DS1_Settling(void){
+    return LSM9DS1_DevSettling(&LSM9DS1_Board);
 };
 
-int16_t LSM9DS1_XM(void){
-    read_SPI(M, OUT_X_L_M, 2);
-    // 0.14 mguass per LSB (for the mode i specified). see datasheet page 12
-    int16_t magX = (int16_t)RDxBuffer;
-    magX = (magX * 14) / 100;
-    return magX;
+// Wake-on-motion. Stillness is spotted in software on the full rate stream (stillUpdate() in final_main.c),
+// the sensor's own inactivity detector stays off (see LSM9DS1_DevInit()) as it would change the AG rate
+// under acquisition. Once the unit has been still long enough LSM9DS1_WakeOnMotion() swaps the sensor into
+// a watch mode (gyro and mag off, accel at 10Hz, the accel interrupt generator on a high passed copy of it
+// so gravity doesn't count) that pulses INT1 on motion, and LSM9DS1_Resume() puts everything back the way it was
+
+// CTRL_REG7_XL fields. See datasheet page 53
+#define CTRL_REG7_XL_HPIS1      0x01   // high pass filtered data to the interrupt generator
+// INT_GEN_CFG_XL fields. See datasheet page 42
+#define INT_GEN_CFG_XL_HIGH     0x2A   // ZHIE | YHIE | XHIE, OR of the three high events
+#define INT_GEN_DUR_XL_MASK     0x7F
+
+// FS_XL full scales in mg, in register order
+static const uint16_t accelFullScales[4] = {2000, 16000, 4000, 8000};
+
+// mg as an accel threshold, compared with the high byte of the output: 1 LSB = full scale / 128
+static uint8_t accelThreshold(struct lsm9ds1_t *dev, uint16_t mg, uint8_t max){
+    uint32_t ths = ((uint32_t)mg * 128 + accelFullScales[dev->config.accelScale & 0x03] / 2) / accelFullScales[dev->config.accelScale & 0x03];
+
+    if (ths == 0) {
+        ths = 1;
+    }
+    return (ths > max) ? max : (uint8_t)ths;
+}
+
+// Watch mode: a high passed change of more than thresholdMg on any axis, lasting longer than duration
+// 10Hz samples, raises INT1 (on P6.6, as armed by LSM9DS1_EnableInt1()). The FIFO and the INT1 sources
+// that were routed are put aside, so the acquisition ISR has to tell this edge apart and leave the sensor
+// alone until LSM9DS1_Resume(). The configuration and LSM9DS1_PowerDown() parts are kept for then
+void LSM9DS1_DevWakeOnMotion(struct lsm9ds1_t *dev, uint16_t thresholdMg, uint8_t duration){
+    uint8_t ths[3], src;
+    uint8_t lock = busLock();
+
+    devRead(dev, AG, INT1_CTRL, &dev->wakeInt1, 1);
+    devRead(dev, AG, FIFO_CTRL, &dev->wakeFifo, 1);
+    devWrite(dev, AG, INT1_CTRL, 0);
+    devWrite(dev, AG, FIFO_CTRL, FIFO_BYPASS << FIFO_CTRL_FMODE_SHIFT);
+    devWrite(dev, M, CTRL_REG3_M, MD_M_OFF);
+    devWrite(dev, AG, CTRL_REG1_G, 0);      // gyro off, accel only
+    devWrite(dev, AG, CTRL_REG6_XL, (ODR_XL_10 << CTRL_REG6_XL_ODR_SHIFT) | (dev->config.accelScale << CTRL_REG6_XL_FS_SHIFT));
+    devWrite(dev, AG, CTRL_REG7_XL, CTRL_REG7_XL_HPIS1);
+    ths[0] = ths[1] = ths[2] = accelThreshold(dev, thresholdMg, 0xFF);
+    devWriteBurst(dev, AG, INT_GEN_THS_X_XL, ths, 3);
+    devWrite(dev, AG, INT_GEN_DUR_XL, duration & INT_GEN_DUR_XL_MASK);
+    devWrite(dev, AG, INT_GEN_CFG_XL, INT_GEN_CFG_XL_HIGH);
+    devRead(dev, AG, INT_GEN_SRC_XL, &src, 1);  // clear anything left over
+    devWrite(dev, AG, INT1_CTRL, LSM9DS1_INT1_IG_XL);
+    P6IFG &= ~BIT6;     // an FTH edge from before isn't motion
+    busUnlock(lock);
 };
 
-int16_t LSM9DS1_YM(void){
-    read_SPI(M, OUT_Y_L_M, 2);
-    // 0.14 mguass per LSB (for the mode i specified). see datasheet page 12
-    int16_t magY = (int16_t)RDxBuffer;
-    magY = (magY * 14) / 100;
-    return magY;
+void LSM9DS1_WakeOnMotion(uint16_t thresholdMg, uint8_t duration){
+    LSM9DS1_DevWakeOnMotion(&LSM9DS1_Board, thresholdMg, duration);
 };
 
-int16_t LSM9DS1_ZM(void){
-    read_SPI(M, OUT_Z_L_M, 2);
-    // 0.14 mguass per LSB (for the mode i specified). see datasheet page 12
-    int16_t magZ = (int16_t)RDxBuffer;
-    magZ = (magZ * 14) / 100;
-    return magZ;    
+// Back from LSM9DS1_WakeOnMotion() to the configuration, FIFO and INT1 sources from before it. The parts
+// that come back settle like after LSM9DS1_PowerUp(). Returns INT_GEN_SRC_XL, bit 6 set if motion woke it
+uint8_t LSM9DS1_DevResume(struct lsm9ds1_t *dev){
+    uint8_t src;
+    uint8_t lock = busLock();
+
+    devWrite(dev, AG, INT1_CTRL, 0);
+    devWrite(dev, AG, INT_GEN_CFG_XL, 0);
+    devRead(dev, AG, INT_GEN_SRC_XL, &src, 1);
+    devWrite(dev, AG, CTRL_REG7_XL, 0);
+    writeAGControl(dev, &dev->config);
+    devWrite(dev, M, CTRL_REG3_M, (dev->poweredDown & LSM9DS1_MAG) ? MD_M_OFF : (dev->config.magPower & 0x03));
+    devWrite(dev, AG, FIFO_CTRL, dev->wakeFifo);     // out of bypass, empty
+    devWrite(dev, AG, INT1_CTRL, dev->wakeInt1);
+    settleWoken(dev, LSM9DS1_ALL & ~dev->poweredDown);
+    busUnlock(lock);
+    return src;
 };
 
-// Temperature sensor output data. 
-// The value is expressed as two’s complement sign extended on the MSB
-int16_t LSM9DS1_TMP(void){
-    read_SPI(AG, OUT_TEMP_L, 2);
-    // 16 LSB/°C. see datasheet page 14
-    int16_t temp = (int16_t)RDxBuffer;
-    temp = (temp * 10) / 16; // so 1 decimal place is preserved
-    return temp;
+uint8_t LSM9DS1_Resume(void){
+    return LSM9DS1_DevResume(&LSM9DS1_Board);
+};
+
+// Calibration. The sensor is only read by the acquisition ISR once it is running, so the collectors are fed
+// samples from the pipeline rather than reading the sensor themselves:
+//   rest: hold the unit still for a second or two, LSM9DS1_CalAddRest() every AG sample, then CalFinishRest()
+//   mag:  LSM9DS1_CalBeginMag(), rotate the unit through every direction while calling CalAddMag() with every
+//         M sample, then CalFinishMag()
+// the finish functions only fill in their part of cal, hand it to LSM9DS1_SetCalibration() to use it
+
+void LSM9DS1_CalBegin(struct lsm9ds1_collector_t *collector){
+    uint8_t i;
+    for (i = 0; i < 3; i++) {
+        collector->gyroSum[i] = 0;
+        collector->accelSum[i] = 0;
+        collector->magMin[i] = 32767;
+        collector->magMax[i] = -32768;
+    }
+    collector->restSamples = 0;
+    collector->magSamples = 0;
+};
+
+void LSM9DS1_CalAddRest(struct lsm9ds1_collector_t *collector, const struct ag_sample_t *sample){
+    collector->gyroSum[0] += sample->gx;
+    collector->gyroSum[1] += sample->gy;
+    collector->gyroSum[2] += sample->gz;
+    collector->accelSum[0] += sample->ax;
+    collector->accelSum[1] += sample->ay;
+    collector->accelSum[2] += sample->az;
+    collector->restSamples++;
+};
+
+// gyro bias is the average at rest. the accel offset is the average less 1 g on whichever axis gravity
+// is mostly along, so the unit only needs to be still, not in a particular position.
+// returns false if nothing was collected
+uint8_t LSM9DS1_DevCalFinishRest(struct lsm9ds1_t *dev, const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out){
+    uint8_t i, down = 0;
+    int16_t mean[3];
+    q16_t accel[3];
+
+    if (collector->restSamples == 0) {
+        return false;
+    }
+    for (i = 0; i < 3; i++) {
+        mean[i] = (int16_t)(collector->gyroSum[i] / collector->restSamples);
+    }
+    convert(mean, out->gyroBias, 3, dev->kG);
+    for (i = 0; i < 3; i++) {
+        mean[i] = (int16_t)(collector->accelSum[i] / collector->restSamples);
+    }
+    convert(mean, accel, 3, dev->kA);
+    for (i = 1; i < 3; i++) {
+        if (((accel[i] < 0) ? -accel[i] : accel[i]) > ((accel[down] < 0) ? -accel[down] : accel[down])) {
+            down = i;
+        }
+    }
+    for (i = 0; i < 3; i++) {
+        out->accelBias[i] = accel[i];
+    }
+    out->accelBias[down] -= (accel[down] < 0) ? -Q16_ONE : Q16_ONE;
+    return true;
+};
+
+uint8_t LSM9DS1_CalFinishRest(const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out){
+    return LSM9DS1_DevCalFinishRest(&LSM9DS1_Board, collector, out);
+};
+
+// clears the chip's offsets so the collected min/max are the true field. samples already read
+// before this still have the old offset taken out, so start feeding CalAddMag() after it
+void LSM9DS1_DevCalBeginMag(struct lsm9ds1_t *dev, struct lsm9ds1_collector_t *collector){
+    struct lsm9ds1_cal_t none = dev->cal;
+    uint8_t i, lock;
+
+    for (i = 0; i < 3; i++) {
+        collector->magMin[i] = 32767;
+        collector->magMax[i] = -32768;
+        none.magOffset[i] = 0;
+    }
+    collector->magSamples = 0;
+    lock = busLock();
+    dev->cal = none;
+    writeMagOffsets(dev);
+    busUnlock(lock);
+};
+
+void LSM9DS1_CalBeginMag(struct lsm9ds1_collector_t *collector){
+    LSM9DS1_DevCalBeginMag(&LSM9DS1_Board, collector);
+};
+
+void LSM9DS1_CalAddMag(struct lsm9ds1_collector_t *collector, const struct m_sample_t *sample){
+    const int16_t *axis = &sample->mx;
+    uint8_t i;
+    for (i = 0; i < 3; i++) {
+        if (axis[i] < collector->magMin[i]) {
+            collector->magMin[i] = axis[i];
+        }
+        if (axis[i] > collector->magMax[i]) {
+            collector->magMax[i] = axis[i];
+        }
+    }
+    collector->magSamples++;
+};
+
+// hard-iron offset is the centre of the min/max box, the soft-iron scale stretches each axis' half range
+// to the average of the three (a diagonal approximation of the full ellipsoid fit).
+// returns false if an axis saw no spread, i.e. the unit wasn't turned enough
+uint8_t LSM9DS1_DevCalFinishMag(struct lsm9ds1_t *dev, const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out){
+    uint8_t i;
+    int16_t centre[3];
+    int32_t radius[3], average = 0;
+
+    for (i = 0; i < 3; i++) {
+        radius[i] = ((int32_t)collector->magMax[i] - collector->magMin[i]) / 2;
+        if ((collector->magSamples == 0) || (radius[i] <= 0)) {
+            return false;
+        }
+        centre[i] = (int16_t)(((int32_t)collector->magMax[i] + collector->magMin[i]) / 2);
+        average += radius[i];
+    }
+    average /= 3;
+    convert(centre, out->magOffset, 3, dev->kM);
+    for (i = 0; i < 3; i++) {
+        out->magScale[i] = (q16_t)(((int64_t)average << 16) / radius[i]);
+    }
+    return true;
+};
+
+uint8_t LSM9DS1_CalFinishMag(const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out){
+    return LSM9DS1_DevCalFinishMag(&LSM9DS1_Board, collector, out);
+};
+
+// starts using cal: the hard-iron offset goes into the chip, the rest is applied by ConvertAG/ConvertM
+void LSM9DS1_DevSetCalibration(struct lsm9ds1_t *dev, const struct lsm9ds1_cal_t *newCal){
+    uint8_t lock = busLock();
+    dev->cal = *newCal;
+    writeMagOffsets(dev);
+    busUnlock(lock);
+};
+
+void LSM9DS1_SetCalibration(const struct lsm9ds1_cal_t *newCal){
+    LSM9DS1_DevSetCalibration(&LSM9DS1_Board, newCal);
+};
+
+void LSM9DS1_DevGetCalibration(struct lsm9ds1_t *dev, struct lsm9ds1_cal_t *out){
+    *out = dev->cal;
+};
+
+void LSM9DS1_GetCalibration(struct lsm9ds1_cal_t *out){
+    LSM9DS1_DevGetCalibration(&LSM9DS1_Board, out);
+};
+
+// Several units on the one bus. LSM9DS1_Init() sets the bus up and brings up LSM9DS1_Board, each other
+// unit gets its own struct lsm9ds1_t and chip select pins, LSM9DS1_DevOpen() and LSM9DS1_DevInit(),
+// and from then on the LSM9DS1_Dev calls take its handle. The units share the bus divider, so each one
+// has to answer at what LSM9DS1_Init() settled on
+
+// Sets dev up for the unit whose AG and M chip selects are the csAG and csM pins of csPort (a PxOUT)
+// and deasserts them, the caller makes them outputs. nothing is sent until LSM9DS1_DevInit()
+void LSM9DS1_DevOpen(struct lsm9ds1_t *dev, volatile uint8_t *csPort, uint8_t csAG, uint8_t csM){
+    dev->csPort = csPort;
+    dev->csAG = csAG;
+    dev->csM = csM;
+    dev->config = configOff;
+    dev->cal = calNone;
+    dev->kA = kATable[configOff.accelScale & 0x03];
+    dev->kG = kGTable[configOff.gyroScale & 0x03];
+    dev->kM = kMTable[configOff.magScale & 0x03];
+    dev->agSettle = 0;
+    dev->mSettle = 0;
+    dev->poweredDown = 0;
+    dev->wakeInt1 = 0;
+    dev->wakeFifo = 0;
+    dev->busCycles = 0;
+    dev->busBytes = 0;
+    dev->busWindowStart = Scheduler_Micros();
+    *csPort |= csAG | csM;
+};
+
+// Checks an opened unit answers, clears what an MCU reset may have left behind, then applies config
+// (LSM9DS1_PROFILE_DEFAULT if 0) and cal (none if 0). returns false, leaving the unit alone, if it doesn't answer
+uint8_t LSM9DS1_DevInit(struct lsm9ds1_t *dev, const struct lsm9ds1_config_t *config, const struct lsm9ds1_cal_t *cal){
+    uint8_t lock;
+
+    if (!LSM9DS1_DevCheckID(dev)) {
+        return false;
+    }
+    lock = busLock();
+    devWrite(dev, AG, CTRL_REG8, 0x44);     // block data update (L and H bytes always from the same sample) and address auto increment for burst reads
+    devWrite(dev, AG, CTRL_REG5_XL, 0x38);  // enable accel output, was supposed to default to this, but didnt
+    devWrite(dev, M, CTRL_REG3_M, 0x00);    // disable i2c, enable spi write operations, continuous conversion
+    devWrite(dev, AG, CTRL_REG9, 0x00);     // gyro awake, FIFO off until LSM9DS1_FIFOInit(), either may be left over from before an MCU reset
+    devWrite(dev, AG, ACT_THS, 0x00);       // inactivity detector off, it would sleep the gyro and drop the AG rate behind acquisition's back
+    devWrite(dev, AG, ACT_DUR, 0x00);
+    busUnlock(lock);
+    LSM9DS1_DevConfigure(dev, (config != 0) ? config : &LSM9DS1_PROFILE_DEFAULT);   // default gyro @ 14.9hz, accel @ 50hz, mag @ 20hz ultra-high performance
+    if (cal != 0) {
+        LSM9DS1_DevSetCalibration(dev, cal);
+    }
+    return true;
+};
+
+// Drains every unit of array back to back in one go, unit i's slots into samples + i * maxSamples with
+// counts[i] saying how many. The unit read first moves on by one each call, so with the FIFOs filling up
+// at the same rate no one unit always waits the longest. Returns the slots read in total. From the
+// acquisition ISR, like LSM9DS1_DevReadFIFO()
+uint16_t LSM9DS1_ReadFIFOs(struct lsm9ds1_array_t *array, struct ag_sample_t *samples, uint8_t maxSamples, uint8_t *counts){
+    uint8_t i, unit;
+    uint16_t total = 0;
+
+    unit = array->next;
+    for (i = 0; i < array->count; i++) {
+        counts[unit] = LSM9DS1_DevReadFIFO(array->devices[unit], &samples[unit * maxSamples], maxSamples);
+        total += counts[unit];
+        unit = (unit + 1 < array->count) ? unit + 1 : 0;
+    }
+    array->next = (array->next + 1 < array->count) ? array->next + 1 : 0;
+    return total;
+};
+
+// What dev's transactions cost since the previous report, measured around every one of them, so it is
+// the real load at the current bus divider and rates. The busy shares of all the units add up to the
+// bus load: more fit at a given ODR while the total stays well under 1000 permille. busCycles wraps after
+// 89 s of bus time
+void LSM9DS1_DevBusReport(struct lsm9ds1_t *dev, struct lsm9ds1_bus_report_t *report){
+    uint32_t now = Scheduler_Micros();
+    uint32_t window = now - dev->busWindowStart;
+    uint32_t cycles, busy;
+    uint8_t lock = busLock();
+
+    cycles = dev->busCycles;
+    report->bytes = dev->busBytes;
+    dev->busCycles = 0;
+    dev->busBytes = 0;
+    busUnlock(lock);
+    busy = Profile_CyclesToUs(cycles);
+    report->windowUs = window;
+    report->busyUs = busy;
+    if (window == 0) {
+        report->busyPermille = 0;
+    } else {
+        report->busyPermille = (busy >= window) ? 1000 : (uint16_t)(((uint64_t)busy * 1000) / window);
+    }
+    dev->busWindowStart = now;
+};
+
+void LSM9DS1_BusReport(struct lsm9ds1_bus_report_t *report){
+    LSM9DS1_DevBusReport(&LSM9DS1_Board, report);
 };
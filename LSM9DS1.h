@@ -1,25 +1,295 @@
+#ifndef LSM9DS1_H
+#define LSM9DS1_H
+
 #include <stdint.h>
 
 #define true 1
 #define false 0
 
+// UCB1 divider tried first by LSM9DS1_Init(), fBitClock = 12 MHz (SMCLK) / divider.
+// 2 (6 MHz) is the fastest the sensor's 10 MHz limit allows
+#ifndef LSM9DS1_SPI_DIVIDER
+#define LSM9DS1_SPI_DIVIDER 2
+#endif
+
 enum ss_t {AG, M, A, G};
 
-void LSM9DS1_Init(void);
+// Q16.16 fixed point physical value: value * 65536
+typedef int32_t q16_t;
+#define Q16_ONE 65536
+
+// raw two's complement AG outputs, filled in one go by LSM9DS1_ReadAGBurst().
+// axes must stay in register order (X, Y, Z) since they are burst-read in place
+struct ag_sample_t {
+    int16_t temp;
+    int16_t gx, gy, gz;
+    int16_t ax, ay, az;
+};
+
+#define LSM9DS1_FIFO_DEPTH 32   // AG FIFO slots, size sample arrays for LSM9DS1_ReadFIFO() with this
+
+// FIFO_CTRL FMODE values. See datasheet page 56
+enum fifo_mode_t {
+    FIFO_BYPASS         = 0,    // FIFO off
+    FIFO_STOP_WHEN_FULL = 1,    // fills up and then stops
+    FIFO_CONT_TO_FIFO   = 3,    // continuous until an interrupt, then stops when full
+    FIFO_BYPASS_TO_CONT = 4,    // bypass until an interrupt, then continuous
+    FIFO_CONTINUOUS     = 6     // newest sample overwrites the oldest when full
+};
+
+// calibration, all in Q16.16 physical units so it holds across full scale changes
+struct lsm9ds1_cal_t {
+    q16_t magOffset[3];     // hard-iron, gauss. written to OFFSET_X/Y/Z_REG_M
+    q16_t magScale[3];      // soft-iron diagonal, Q16_ONE is no correction
+    q16_t gyroBias[3];      // dps at rest
+    q16_t accelBias[3];     // g, gravity taken out
+};
+
+// what the calibration routines gather before working out a struct lsm9ds1_cal_t
+struct lsm9ds1_collector_t {
+    int32_t gyroSum[3];
+    int32_t accelSum[3];
+    uint16_t restSamples;   // up to a little over a minute at 952Hz before the sums can overflow
+    int16_t magMin[3];
+    int16_t magMax[3];
+    uint16_t magSamples;
+};
+
+// CTRL_REG1_G ODR_G values. See datasheet page 45
+enum odr_g_t {ODR_G_OFF, ODR_G_14_9, ODR_G_59_5, ODR_G_119, ODR_G_238, ODR_G_476, ODR_G_952};
+// CTRL_REG1_G FS_G values
+enum fs_g_t {FS_G_245 = 0, FS_G_500 = 1, FS_G_2000 = 3};
+// CTRL_REG6_XL ODR_XL values. See datasheet page 52
+enum odr_xl_t {ODR_XL_OFF, ODR_XL_10, ODR_XL_50, ODR_XL_119, ODR_XL_238, ODR_XL_476, ODR_XL_952};
+// CTRL_REG6_XL FS_XL values, in register order
+enum fs_xl_t {FS_XL_2G = 0, FS_XL_16G = 1, FS_XL_4G = 2, FS_XL_8G = 3};
+// CTRL_REG1_M DO values. See datasheet page 63
+enum odr_m_t {ODR_M_0_625, ODR_M_1_25, ODR_M_2_5, ODR_M_5, ODR_M_10, ODR_M_20, ODR_M_40, ODR_M_80};
+// CTRL_REG2_M FS values. See datasheet page 64
+enum fs_m_t {FS_M_4, FS_M_8, FS_M_12, FS_M_16};
+// CTRL_REG1_M OM / CTRL_REG4_M OMZ values, more performance for more current
+enum om_m_t {OM_M_LOW_POWER, OM_M_MEDIUM, OM_M_HIGH, OM_M_ULTRA_HIGH};
+// CTRL_REG3_M MD values. See datasheet page 64
+enum md_m_t {MD_M_CONTINUOUS = 0, MD_M_SINGLE = 1, MD_M_OFF = 3};
+
+#define LSM9DS1_XL_BW_AUTO 0xFF     // accelBandwidth: anti-aliasing bandwidth picked by the ODR
+
+// everything LSM9DS1_Configure() sets, bandwidths are the 0-3 BW_G / BW_XL field values
+struct lsm9ds1_config_t {
+    enum odr_g_t gyroRate;
+    enum fs_g_t gyroScale;
+    uint8_t gyroBandwidth;
+    enum odr_xl_t accelRate;
+    enum fs_xl_t accelScale;
+    uint8_t accelBandwidth;
+    enum odr_m_t magRate;
+    enum fs_m_t magScale;
+    enum om_m_t magMode;
+    enum md_m_t magPower;   // MD_M_OFF powers the magnetometer down, like ODR_G_OFF for the gyro
+};
+
+extern const struct lsm9ds1_config_t LSM9DS1_PROFILE_DEFAULT;    // what LSM9DS1_Init() sets up
+extern const struct lsm9ds1_config_t LSM9DS1_PROFILE_VIBRATION;  // 952Hz, widest ranges
+extern const struct lsm9ds1_config_t LSM9DS1_PROFILE_LOW_POWER;  // gyro off, slow accel and mag
+
+// what LSM9DS1_InitFrom() restores, see LSM9DS1_GetState(). The rates and ranges aren't in here,
+// they belong to whatever the application is doing (final_main.c sets them per state on entry)
+struct lsm9ds1_state_t {
+    uint16_t busDivider;
+    struct lsm9ds1_cal_t cal;
+};
+
+// One LSM9DS1 on the shared bus, see LSM9DS1_DevOpen(). Everything the driver keeps for a unit is in
+// here, the LSM9DS1_ calls without a handle work on LSM9DS1_Board
+struct lsm9ds1_t {
+    volatile uint8_t *csPort;       // chip select output, e.g. &P6OUT
+    uint8_t csAG;                   // pins driven low for the A/G subchip
+    uint8_t csM;                    // and for the M subchip
+    struct lsm9ds1_config_t config; // what LSM9DS1_DevConfigure() last set
+    struct lsm9ds1_cal_t cal;       // see LSM9DS1_DevSetCalibration()
+    int32_t kA, kG, kM;             // conversion constants for config's full scales
+    volatile uint16_t agSettle;     // AG FIFO slots still to be dropped after a part was switched on or woken
+    volatile uint16_t mSettle;      // AG slots until the M output is trusted
+    uint8_t poweredDown;            // LSM9DS1_GYRO/ACCEL/MAG parts held down by LSM9DS1_DevPowerDown()
+    uint8_t wakeInt1, wakeFifo;     // INT1_CTRL and FIFO_CTRL from before LSM9DS1_DevWakeOnMotion()
+    uint32_t busCycles;             // MCLK cycles its transactions held the bus, since the last bus report
+    uint32_t busBytes;              // bytes they moved, address bytes included
+    uint32_t busWindowStart;        // Scheduler_Micros() at the last bus report
+};
+
+extern struct lsm9ds1_t LSM9DS1_Board;  // the unit on P6.0/P6.1, set up by LSM9DS1_Init()
+
+// units drained together by LSM9DS1_ReadFIFOs()
+struct lsm9ds1_array_t {
+    struct lsm9ds1_t *const *devices;
+    uint8_t count;
+    uint8_t next;       // the unit read first next time, moves round
+};
+
+// from LSM9DS1_DevBusReport()
+struct lsm9ds1_bus_report_t {
+    uint32_t windowUs;      // time covered, since the previous report
+    uint32_t busyUs;        // time the unit's transactions held the bus, waits for it included
+    uint16_t busyPermille;  // share of the window, 0-1000
+    uint32_t bytes;         // bytes moved, address bytes included
+};
+
+// parts for LSM9DS1_PowerDown()/PowerUp(), OR them together
+#define LSM9DS1_GYRO    0x01    // gyro sleep (CTRL_REG9 SLEEP_G), the accel and FIFO carry on at the gyro's ODR
+#define LSM9DS1_ACCEL   0x02    // the whole A/G subchip (both ODRs 0), the FIFO and INT1 stop with it
+#define LSM9DS1_MAG     0x04    // magnetometer power-down (CTRL_REG3_M MD)
+#define LSM9DS1_ALL     (LSM9DS1_GYRO | LSM9DS1_ACCEL | LSM9DS1_MAG)
+
+// settle times after a part is woken or switched on, before its output is used. the datasheet
+// gives no gyro turn-on time, 80ms is what ST quotes for its other MEMS gyros
+#define LSM9DS1_SETTLE_G_MS         80
+#define LSM9DS1_SETTLE_XL_SLOTS     2   // accel only, filter start up
+#define LSM9DS1_SETTLE_M_PERIODS    2   // magnetometer conversions
+
+// INT1_CTRL sources for LSM9DS1_EnableInt1(), OR them together. See datasheet page 44
+#define LSM9DS1_INT1_DRDY_XL    0x01   // new accel sample
+#define LSM9DS1_INT1_DRDY_G     0x02   // new gyro sample
+#define LSM9DS1_INT1_BOOT       0x04   // boot status
+#define LSM9DS1_INT1_FTH        0x08   // FIFO at or above its watermark
+#define LSM9DS1_INT1_OVR        0x10   // FIFO overrun
+#define LSM9DS1_INT1_FSS5       0x20   // FIFO full
+#define LSM9DS1_INT1_IG_XL      0x40   // accel interrupt generator
+#define LSM9DS1_INT1_IG_G       0x80   // gyro interrupt generator
+
+// raw two's complement M outputs, filled by LSM9DS1_ReadMBurst()
+struct m_sample_t {
+    int16_t mx, my, mz;
+};
+
+// one AG FIFO slot plus the newest M reading taken alongside it, and the Scheduler_Micros() time
+// the slot was sampled at. the IMU_CHANNELS int16_t come first, so an array of these can go through
+// filter.h as frames of IMU_STRIDE int16_t
+struct imu_sample_t {
+    struct ag_sample_t ag;
+    struct m_sample_t m;
+    uint32_t time;
+};
+#define IMU_CHANNELS ((sizeof(struct ag_sample_t) + sizeof(struct m_sample_t)) / sizeof(int16_t))
+#define IMU_STRIDE   (sizeof(struct imu_sample_t) / sizeof(int16_t))
+
+// converted samples from LSM9DS1_ConvertAG()/ConvertM(), in C, dps, g and gauss
+struct ag_value_t {
+    q16_t temp;
+    q16_t gx, gy, gz;
+    q16_t ax, ay, az;
+};
+
+struct m_value_t {
+    q16_t mx, my, mz;
+};
+
+uint16_t LSM9DS1_Init(void);
+uint16_t LSM9DS1_InitFrom(const struct lsm9ds1_state_t *state);
+void LSM9DS1_GetState(struct lsm9ds1_state_t *state);
+uint16_t LSM9DS1_SetBusDivider(uint16_t divider);
+uint16_t LSM9DS1_GetBusDivider(void);
+uint8_t LSM9DS1_CheckID(void);
 
 uint16_t LSM9DS1_WHO_AM_I(enum ss_t device);
+
+// raw bus access under the LSM9DS1_* API, for bench_main.c. not locked against the acquisition ISR
+uint8_t SPI_transfer(uint8_t data);
+void read_SPI(enum ss_t device, uint8_t address, uint8_t *data, uint16_t bytesToRead);
 uint16_t LSM9DS1_TEST_CMD();
 
-int16_t LSM9DS1_XA(void);
-int16_t LSM9DS1_YA(void);
-int16_t LSM9DS1_ZA(void);
+q16_t LSM9DS1_XA(void);
+q16_t LSM9DS1_YA(void);
+q16_t LSM9DS1_ZA(void);
+
+q16_t LSM9DS1_XG(void);
+q16_t LSM9DS1_YG(void);
+q16_t LSM9DS1_ZG(void);
+
+q16_t LSM9DS1_XM(void);
+q16_t LSM9DS1_YM(void);
+q16_t LSM9DS1_ZM(void);
+
+q16_t LSM9DS1_TMP(void);
+
+void LSM9DS1_ReadAGBurst(struct ag_sample_t *sample);
+void LSM9DS1_ReadMBurst(struct m_sample_t *sample);
+
+// raw to physical units, scaled the same as the single axis getters
+void LSM9DS1_Convert(const int16_t *raw, q16_t *out, uint16_t count, enum ss_t device);
+void LSM9DS1_ConvertAG(const struct ag_sample_t *raw, struct ag_value_t *out);
+void LSM9DS1_ConvertM(const struct m_sample_t *raw, struct m_value_t *out);
+q16_t LSM9DS1_ScaleA(int16_t raw);
+q16_t LSM9DS1_ScaleG(int16_t raw);
+q16_t LSM9DS1_ScaleM(int16_t raw);
+q16_t LSM9DS1_ScaleTMP(int16_t raw);
+int32_t LSM9DS1_Q16ToFixed(q16_t value, int32_t multiplier);
+
+void LSM9DS1_FIFOInit(enum fifo_mode_t mode, uint8_t watermark);
+uint8_t LSM9DS1_FIFOStatus(void);
+uint8_t LSM9DS1_ReadFIFO(struct ag_sample_t *samples, uint8_t maxSamples);
+
+void LSM9DS1_Configure(const struct lsm9ds1_config_t *config);
+void LSM9DS1_GetConfig(struct lsm9ds1_config_t *config);
+uint32_t LSM9DS1_SampleRate(void);
+
+void LSM9DS1_CalBegin(struct lsm9ds1_collector_t *collector);
+void LSM9DS1_CalAddRest(struct lsm9ds1_collector_t *collector, const struct ag_sample_t *sample);
+uint8_t LSM9DS1_CalFinishRest(const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out);
+void LSM9DS1_CalBeginMag(struct lsm9ds1_collector_t *collector);
+void LSM9DS1_CalAddMag(struct lsm9ds1_collector_t *collector, const struct m_sample_t *sample);
+uint8_t LSM9DS1_CalFinishMag(const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out);
+void LSM9DS1_SetCalibration(const struct lsm9ds1_cal_t *cal);
+void LSM9DS1_GetCalibration(struct lsm9ds1_cal_t *cal);
+
+void LSM9DS1_PowerDown(uint8_t parts);
+void LSM9DS1_PowerUp(uint8_t parts);
+uint8_t LSM9DS1_PoweredDown(void);
+uint8_t LSM9DS1_Settling(void);
+
+void LSM9DS1_EnableInt1(uint8_t sources);
+uint8_t LSM9DS1_Int1Active(void);
+
+void LSM9DS1_WakeOnMotion(uint16_t thresholdMg, uint8_t duration);
+uint8_t LSM9DS1_Resume(void);
+
+void LSM9DS1_BusReport(struct lsm9ds1_bus_report_t *report);
+
+// the same for any unit. LSM9DS1_Init() sets up the bus first, then each extra unit is opened and initialised
+void LSM9DS1_DevOpen(struct lsm9ds1_t *dev, volatile uint8_t *csPort, uint8_t csAG, uint8_t csM);
+uint8_t LSM9DS1_DevInit(struct lsm9ds1_t *dev, const struct lsm9ds1_config_t *config, const struct lsm9ds1_cal_t *cal);
+uint8_t LSM9DS1_DevCheckID(struct lsm9ds1_t *dev);
+uint16_t LSM9DS1_DevWHO_AM_I(struct lsm9ds1_t *dev, enum ss_t device);
+
+void LSM9DS1_DevReadAGBurst(struct lsm9ds1_t *dev, struct ag_sample_t *sample);
+void LSM9DS1_DevReadMBurst(struct lsm9ds1_t *dev, struct m_sample_t *sample);
+void LSM9DS1_DevConvert(struct lsm9ds1_t *dev, const int16_t *raw, q16_t *out, uint16_t count, enum ss_t device);
+void LSM9DS1_DevConvertAG(struct lsm9ds1_t *dev, const struct ag_sample_t *raw, struct ag_value_t *out);
+void LSM9DS1_DevConvertM(struct lsm9ds1_t *dev, const struct m_sample_t *raw, struct m_value_t *out);
+
+void LSM9DS1_DevFIFOInit(struct lsm9ds1_t *dev, enum fifo_mode_t mode, uint8_t watermark);
+uint8_t LSM9DS1_DevFIFOStatus(struct lsm9ds1_t *dev);
+uint8_t LSM9DS1_DevReadFIFO(struct lsm9ds1_t *dev, struct ag_sample_t *samples, uint8_t maxSamples);
+uint16_t LSM9DS1_ReadFIFOs(struct lsm9ds1_array_t *array, struct ag_sample_t *samples, uint8_t maxSamples, uint8_t *counts);
+
+void LSM9DS1_DevConfigure(struct lsm9ds1_t *dev, const struct lsm9ds1_config_t *config);
+void LSM9DS1_DevGetConfig(struct lsm9ds1_t *dev, struct lsm9ds1_config_t *config);
+uint32_t LSM9DS1_DevSampleRate(struct lsm9ds1_t *dev);
+
+uint8_t LSM9DS1_DevCalFinishRest(struct lsm9ds1_t *dev, const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out);
+void LSM9DS1_DevCalBeginMag(struct lsm9ds1_t *dev, struct lsm9ds1_collector_t *collector);
+uint8_t LSM9DS1_DevCalFinishMag(struct lsm9ds1_t *dev, const struct lsm9ds1_collector_t *collector, struct lsm9ds1_cal_t *out);
+void LSM9DS1_DevSetCalibration(struct lsm9ds1_t *dev, const struct lsm9ds1_cal_t *cal);
+void LSM9DS1_DevGetCalibration(struct lsm9ds1_t *dev, struct lsm9ds1_cal_t *cal);
+
+void LSM9DS1_DevPowerDown(struct lsm9ds1_t *dev, uint8_t parts);
+void LSM9DS1_DevPowerUp(struct lsm9ds1_t *dev, uint8_t parts);
+uint8_t LSM9DS1_DevPoweredDown(struct lsm9ds1_t *dev);
+uint8_t LSM9DS1_DevSettling(struct lsm9ds1_t *dev);
 
-int16_t LSM9DS1_XG(void);
-int16_t LSM9DS1_YG(void);
-int16_t LSM9DS1_ZG(void);
+void LSM9DS1_DevEnableInt1(struct lsm9ds1_t *dev, uint8_t sources);
+void LSM9DS1_DevWakeOnMotion(struct lsm9ds1_t *dev, uint16_t thresholdMg, uint8_t duration);
+uint8_t LSM9DS1_DevResume(struct lsm9ds1_t *dev);
 
-int16_t LSM9DS1_XM(void);
-int16_t LSM9DS1_YM(void);
-int16_t LSM9DS1_ZM(void);
+void LSM9DS1_DevBusReport(struct lsm9ds1_t *dev, struct lsm9ds1_bus_report_t *report);
 
-int16_t LSM9DS1_TMP(void);
+#endif
@@ -46,9 +46,14 @@ those of the authors and should not be interpreted as representing official
 policies, either expressed or implied, of the FreeBSD Project.
 */
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include "msp.h"
 #include "../inc/SSD1306.h"
+#include "SSD1306_ext.h"
+#include "dma.h"
+#include "profile.h"
+#include "spi.h"
 // Blue Adafruit 938 SSD1306 oLED (powered with 5V)
 // Signal        (SSD1306)     LaunchPad pin
 // UCA3SIMO      (Data, pin 1) connected to P9.7
@@ -75,11 +80,20 @@ policies, either expressed or implied, of the FreeBSD Project.
 #define SSD1306_MODE_DATA DC=DC_BIT; ///< Data mode
 #define RESET       (*((volatile uint8_t *)0x4209904C))   /* Port 9 Output, bit 3 is RESET*/    //What does this do?
 #define RESET_BIT 0x08
-uint8_t buffer[WIDTH*HEIGHT/8]; // 8192 bits or 1024 bytes
+#define OLED_DMA_CH 6     // uDMA channel 6 is triggered by eUSCI_A3 TX
+SPI_DEFINE_DMA(oledBus, EUSCI_A3, DMA_CH6_EUSCIA3TX) // UCA3STE does CS, long data runs go by DMA
+static uint8_t frame[2][WIDTH*HEIGHT/8]; // two 8192 bit (1024 byte) frames
+uint8_t *buffer = frame[0];     // frame the drawing functions write to (the back buffer)
+static uint8_t *front = frame[1];// last frame handed to SSD1306_SwapBuffers(), only used when double buffered
+static int doubleBuffered = false;
+static volatile uint8_t DMABusy = false; // true while a frame is being sent by the DMA
 int vccstate;
 // vccstate = SSD1306_SWITCHCAPVCC for normal internal 3.3V power
 //            SSD1306_EXTERNALVCC for separate external power
 int rotation;
+// dirty column range of each page of buffer[] that has not been sent to
+// the display yet. A page is clean when dirtyLo > dirtyHi.
+static uint8_t dirtyLo[HEIGHT/8], dirtyHi[HEIGHT/8];
 void SSD1306_ssd1306_command(uint8_t c);
 void SSD1306_drawFastHLineInternal(int16_t x, int16_t y, int16_t w, uint16_t color);
 void SSD1306_drawFastVLineInternal(int16_t x, int16_t y, int16_t h, uint16_t color);
@@ -224,52 +238,94 @@ static const uint8_t ASCII[][5] = {
 //  ,{0x78, 0x46, 0x41, 0x46, 0x78} // 7f DEL
   ,{0x1f, 0x24, 0x7c, 0x24, 0x1f} // 7f UT sign
 };
+// ' ' to '9' as the 6 columns SSD1306_BufOutChar() draws them (ASCII[] plus
+// the blank padding column), so number text is copied into buffer[] a whole
+// character at a time. Covers every character SSD1306_FormatSFix1() writes.
+#define RUN_FIRST 0x20
+#define RUN_LAST  0x39
+static const uint8_t glyphRuns[RUN_LAST - RUN_FIRST + 1][6] = {
+   {0x00, 0x00, 0x00, 0x00, 0x00, 0x00} // 20
+  ,{0x00, 0x00, 0x5f, 0x00, 0x00, 0x00} // 21 !
+  ,{0x00, 0x07, 0x00, 0x07, 0x00, 0x00} // 22 "
+  ,{0x14, 0x7f, 0x14, 0x7f, 0x14, 0x00} // 23 #
+  ,{0x24, 0x2a, 0x7f, 0x2a, 0x12, 0x00} // 24 $
+  ,{0x23, 0x13, 0x08, 0x64, 0x62, 0x00} // 25 %
+  ,{0x36, 0x49, 0x55, 0x22, 0x50, 0x00} // 26 &
+  ,{0x00, 0x05, 0x03, 0x00, 0x00, 0x00} // 27 '
+  ,{0x00, 0x1c, 0x22, 0x41, 0x00, 0x00} // 28 (
+  ,{0x00, 0x41, 0x22, 0x1c, 0x00, 0x00} // 29 )
+  ,{0x14, 0x08, 0x3e, 0x08, 0x14, 0x00} // 2a *
+  ,{0x08, 0x08, 0x3e, 0x08, 0x08, 0x00} // 2b +
+  ,{0x00, 0x50, 0x30, 0x00, 0x00, 0x00} // 2c ,
+  ,{0x08, 0x08, 0x08, 0x08, 0x08, 0x00} // 2d -
+  ,{0x00, 0x60, 0x60, 0x00, 0x00, 0x00} // 2e .
+  ,{0x20, 0x10, 0x08, 0x04, 0x02, 0x00} // 2f /
+  ,{0x3e, 0x51, 0x49, 0x45, 0x3e, 0x00} // 30 0
+  ,{0x00, 0x42, 0x7f, 0x40, 0x00, 0x00} // 31 1
+  ,{0x42, 0x61, 0x51, 0x49, 0x46, 0x00} // 32 2
+  ,{0x21, 0x41, 0x45, 0x4b, 0x31, 0x00} // 33 3
+  ,{0x18, 0x14, 0x12, 0x7f, 0x10, 0x00} // 34 4
+  ,{0x27, 0x45, 0x45, 0x45, 0x39, 0x00} // 35 5
+  ,{0x3c, 0x4a, 0x49, 0x49, 0x30, 0x00} // 36 6
+  ,{0x01, 0x71, 0x09, 0x05, 0x03, 0x00} // 37 7
+  ,{0x36, 0x49, 0x49, 0x49, 0x36, 0x00} // 38 8
+  ,{0x06, 0x49, 0x49, 0x29, 0x1e, 0x00} // 39 9
+};
 #define ssd1306_swap(a, b) \
 (((a) ^= (b)), ((b) ^= (a)), ((a) ^= (b))) ///< No-temp-var swap operation
 
+// Mark columns x0 to x1 of pages page0 to page1 of buffer[] as changed.
+// The range is clipped to the screen; an empty range does nothing.
+static void markDirty(int16_t x0, int16_t x1, int16_t page0, int16_t page1){
+  if(x0 < 0) x0 = 0;
+  if(x1 > (WIDTH - 1)) x1 = WIDTH - 1;
+  if(page0 < 0) page0 = 0;
+  if(page1 > ((HEIGHT/8) - 1)) page1 = (HEIGHT/8) - 1;
+  for(; page0 <= page1; page0++){
+    if(x0 < dirtyLo[page0]) dirtyLo[page0] = x0;
+    if(x1 > dirtyHi[page0]) dirtyHi[page0] = x1;
+  }
+}
+
+// Mark all of buffer[] as matching the display.
+static void clearDirty(void){int i;
+  for(i=0; i<(HEIGHT/8); i++){
+    dirtyLo[i] = WIDTH;
+    dirtyHi[i] = 0;
+  }
+}
 
 
 
-// This is a helper function that sends 8-bit commands to the LCD.
-// Inputs: command  8-bit function code to transmit
+
+// This is a helper function that sends bytes to the LCD in one transaction,
+// commands with DC low (dc = false) or display data with DC high (dc = true).
+// Inputs: dc     data (true) or command (false)
+//         data   bytes to transmit
+//         count  how many
 // Outputs: none
 // Assumes: UCA3 and Port 9 have already been initialized and enabled
-// The Data/Command pin must be valid when the eighth bit is
-// sent.  The eUSCI module has no hardware FIFOs.
-// 1) Wait for SPI to be idle (let previous frame finish)
-// 2) Set DC for command (0)
-// 3) Write command to TXBUF, starts SPI
-// 4) Wait for SPI to be idle (after transmission complete)
+// Queues behind a DMA frame that is still going out, since the frame owns
+// the bus and DC, and returns once the last byte has shifted out. Runs of
+// SPI_DMA_MIN bytes or more are moved by the DMA while this waits.
+static void oledwrite(uint8_t dc, const uint8_t *data, uint16_t count){
+  struct spi_txn_t txn = {0};
+
+  txn.dcPort = &P9OUT;
+  txn.dcMask = DC_BIT;
+  txn.dc = dc;
+  txn.tx = data;
+  txn.txCount = count;
+  oledBus_Run(&txn);
+}
 void static commandwrite(uint8_t command){
-// you write this as part of Lab 6
-
-        while(UCA3STATW & 0x01);    //wait for SPI to be idle(check flag) - stays here while the busy flag is high
-        P9OUT &= ~0x40;             //set DC (P9.6) for command
-        UCA3TXBUF = command;        //fill the TXBUF, this starts transfer
-        while(UCA3STATW & 0x01);    //wait for SPI to be idle - stays here while the busy flag is high
+  oledwrite(false, &command, 1);
 }
 void ssd1306_Testcommandwrite(void){
   while(1){
     commandwrite(0x21);
   }
 }
-// This is a helper function that sends 8-bit data to the LCD.
-// Inputs: data  8-bit data to transmit
-// Outputs: none
-// Assumes: UCA3 and Port 9 have already been initialized and enabled
-// The Data/Command pin must be valid when the eighth bit is
-// sent.  The eUSCI module has no hardware FIFOs.
-// 1) Wait for transmitter to be empty (let previous frame finish)
-// 2) Set DC for data (1)
-// 3) Write data to TXBUF, this starts SPI
-// Note: takes 2us to output a byte
-void static datawrite(uint8_t data){
-// you write this as part of Lab 6
-       while(UCA3STATW & 0x01);    //wait for SPI to be idle(check flag) - stays here while the busy flag is high
-       P9OUT |=  0x40;      //set DC (P9.6) for data
-       UCA3TXBUF = data;    //fill the TXBUF, this starts transfer
-       //why do we not wait for SPI to idle like with commandWrite?
-}
 // 8000000 bps, msb first, mode0
 
 void ssd1306_command(uint8_t c) {
@@ -279,10 +335,7 @@ void ssd1306_command1(uint8_t c) {
   commandwrite(c);
 }
 void ssd1306_commandList(const uint8_t *c, uint32_t n) {
-  while(n--) {
-    commandwrite(*c);
-    c++;
-  }
+  oledwrite(false, c, n);     // back to back in one transaction
 }
 
 // ALLOCATE & INIT DISPLAY -------------------------------------------------
@@ -381,6 +434,8 @@ int SSD1306_Init(int vccst) {
   P9->DIR |= (DC_BIT|RESET_BIT);        // make P9.3 and P9.6 out (Reset and D/C pins)
   EUSCI_A3->CTLW0 &= ~0x0001;           // enable eUSCI module
   EUSCI_A3->IE &= ~0x0003;              // disable interrupts
+  DMA_Init();
+  DMA_EnableInterrupt(1, OLED_DMA_CH);  // frame done goes to DMA_INT1_IRQHandler
 
   RESET = 0;                            // reset the LCD to a known state, RESET low
   for(delay=0; delay<10; delay=delay+1);// delay minimum 100 ns
@@ -439,16 +494,18 @@ void SSD1306_DrawPixel(int16_t x, int16_t y, uint16_t color) {
      case BLACK:   buffer[x + (y/8)*WIDTH] &= ~(1 << (y&7)); break;
      case INVERSE: buffer[x + (y/8)*WIDTH] ^=  (1 << (y&7)); break;
     }
+    markDirty(x, x, y/8, y/8);
   }
 }
-// color is white or black, not invert
-void SSD1306_DrawChar(int16_t x, int16_t y, char letter, uint16_t color){int mask;
+// One pixel at a time through SSD1306_DrawPixel. Only used for characters
+// hanging off the top or bottom edge, where the column blits don't apply.
+static void drawCharPixels(int16_t x, int16_t y, const uint8_t *glyph, uint16_t color){int mask;
 uint16_t dot;
   int i, j;
   for(i=0;i<5;i++){
     mask=0x01;
     for(j=0; j<7; j++){
-      if(ASCII[letter-0x20][i]&mask){
+      if(glyph[i]&mask){
         dot = color;
       }else{
         dot = color^1;
@@ -458,6 +515,123 @@ uint16_t dot;
     }
   }
 }
+
+// Reverse the 7 glyph rows of a font column (bit 0 <-> bit 6).
+static uint8_t reverse7(uint8_t col){int j;
+  uint8_t rev = 0;
+  for(j=0; j<7; j++){
+    rev = (rev << 1) | (col & 0x01);
+    col = col >> 1;
+  }
+  return rev;
+}
+
+// Rotation 0 and 2: each font column lands in one buffer column, as the low
+// 7 bits of a byte shifted down by y%8, so it is merged in with at most two
+// byte writes (one when y is page aligned or 1 below). x is the buffer
+// column of glyph column 0 and dx is +1 or -1 (mirrored for rotation 2, which
+// also flips the rows). y is the buffer row of glyph row 0, 0 to HEIGHT-7.
+static void drawGlyphColumns(int16_t x, int16_t dx, int16_t y, const uint8_t *glyph, uint16_t color, int flip){int i;
+  uint8_t *pBuf = &buffer[(y/8)*WIDTH];
+  uint8_t shift = y&7;
+  uint16_t mask = 0x7F << shift;        // the 7 rows this character covers
+  uint16_t bits;
+  uint8_t col;
+  markDirty((dx > 0) ? x : x - 4, (dx > 0) ? x + 4 : x, y/8, (y + 6)/8);
+  for(i=0; i<5; i=i+1, x=x+dx){
+    if((x < 0) || (x >= WIDTH)){
+      continue;                         // clipped on the left or right
+    }
+    col = flip ? reverse7(glyph[i]) : glyph[i];
+    if(color == BLACK){
+      col = ~col;                       // dots off, background on
+    }
+    bits = ((uint16_t)(col & 0x7F)) << shift;
+    pBuf[x] = (pBuf[x] & ~mask) | bits;
+    if(shift > 1){                      // spills into the next page
+      pBuf[x + WIDTH] = (pBuf[x + WIDTH] & ~(mask >> 8)) | (bits >> 8);
+    }
+  }
+}
+
+// Rotation 1 and 3: each font column becomes one buffer row, so its 7 dots
+// are one bit (the same mask) in 7 neighbouring bytes of a page. x,y are
+// unrotated and are bounds checked the same way SSD1306_DrawPixel does.
+static void drawGlyphRows(int16_t x, int16_t y, const uint8_t *glyph, uint16_t color){int i, j;
+  int16_t bx, by;
+  uint8_t *pBuf;
+  uint8_t bit, col;
+  if(rotation == 1){
+    markDirty(WIDTH - 1 - (y + 6), WIDTH - 1 - y, x/8, (x + 4)/8);
+  }else{
+    markDirty(y, y + 6, (HEIGHT - 1 - (x + 4))/8, (HEIGHT - 1 - x)/8);
+  }
+  for(i=0; i<5; i=i+1){
+    if(((x + i) < 0) || ((x + i) >= WIDTH)){
+      continue;
+    }
+    by = (rotation == 1) ? (x + i) : (HEIGHT - 1 - (x + i));
+    if((by < 0) || (by >= HEIGHT)){
+      continue;                         // off the rotated screen
+    }
+    pBuf = &buffer[(by/8)*WIDTH];
+    bit = 1 << (by&7);
+    col = (color == BLACK) ? ~glyph[i] : glyph[i];
+    for(j=0; j<7; j=j+1){
+      if(((y + j) < 0) || ((y + j) >= HEIGHT)){
+        continue;
+      }
+      bx = (rotation == 1) ? (WIDTH - 1 - (y + j)) : (y + j);
+      if(col & (1 << j)){
+        pBuf[bx] |= bit;
+      }else{
+        pBuf[bx] &= ~bit;
+      }
+    }
+  }
+}
+
+// color is white or black, not invert
+// Draws the 5x7 dots of the character, background included, and leaves
+// the 6th column and 8th row alone. The font is column-major with one byte
+// per column, the same layout as the SSD1306 pages, so whole columns are
+// merged into buffer[] instead of going through SSD1306_DrawPixel 35 times.
+void SSD1306_DrawChar(int16_t x, int16_t y, char letter, uint16_t color){
+  const uint8_t *glyph;
+  if(((uint8_t)letter < 0x20) || ((uint8_t)letter > 0x7F)){
+    return;                             // not in the font
+  }
+  glyph = ASCII[(uint8_t)letter - 0x20];
+  switch(rotation){
+   case 0:
+    if((y >= 0) && (y <= (HEIGHT - 7))){
+      drawGlyphColumns(x, 1, y, glyph, color, false);
+      return;
+    }
+    break;
+   case 2:
+    if((y >= 0) && (y <= (HEIGHT - 7))){
+      drawGlyphColumns(WIDTH - 1 - x, -1, HEIGHT - 7 - y, glyph, color, true);
+      return;
+    }
+    break;
+   case 1:
+   case 3:
+    drawGlyphRows(x, y, glyph, color);
+    return;
+  }
+  drawCharPixels(x, y, glyph, color);   // partly off the top or bottom
+}
+#ifdef BENCHMARK
+// SSD1306_DrawChar as it was before the column blits, all 35 dots through
+// SSD1306_DrawPixel, so bench_main.c can time the two side by side.
+void SSD1306_DrawCharPixels(int16_t x, int16_t y, char letter, uint16_t color){
+  if(((uint8_t)letter < 0x20) || ((uint8_t)letter > 0x7F)){
+    return;                             // not in the font
+  }
+  drawCharPixels(x, y, ASCII[(uint8_t)letter - 0x20], color);
+}
+#endif
 // color is white or black, not invert
 void SSD1306_DrawString(int16_t x, int16_t y, char *pt, uint16_t color){
   while(*pt){
@@ -478,6 +652,7 @@ void SSD1306_ClearBuffer(void) {int i;
   for(i=0; i<WIDTH*HEIGHT/8; i++){
     buffer[i] = 0;
   }
+  markDirty(0, WIDTH - 1, 0, (HEIGHT/8) - 1);
   SSD1306_SetCursor(0, 0);
 }
 
@@ -486,6 +661,7 @@ void SSD1306_ClearBuffer(void) {int i;
             reset the cursor to (0,0) (top left corner of screen).
     @return None (void).
 */
+static const uint8_t blankPage[WIDTH];   // one page of 0x00 for SSD1306_Clear()
 void SSD1306_Clear(void) {int i;
   // clear the entire screen, even any columns on the right that did not contain text
   ssd1306_command(SSD1306_PAGEADDR);
@@ -494,8 +670,8 @@ void SSD1306_Clear(void) {int i;
   ssd1306_command(SSD1306_COLUMNADDR);
   ssd1306_command(0);                   // column start address
   ssd1306_command(WIDTH - 1);           // column end address
-  for(i=0; i<WIDTH*HEIGHT/8; i++){
-    datawrite(0x00);
+  for(i=0; i<(HEIGHT/8); i++){
+    oledwrite(true, blankPage, WIDTH);
   }
   SSD1306_SetCursor(0, 0);
 }
@@ -509,7 +685,6 @@ void SSD1306_Clear(void) {int i;
             Image is sent to screen directly, RAM buffer is unchanged.
 */
 void SSD1306_DrawFullImage(const uint8_t *ptr){
-  int i;
   // over-write the entire screen, even any columns on the right that did not contain text
   ssd1306_command(SSD1306_PAGEADDR);
   ssd1306_command(0);                   // page start address
@@ -517,9 +692,7 @@ void SSD1306_DrawFullImage(const uint8_t *ptr){
   ssd1306_command(SSD1306_COLUMNADDR);
   ssd1306_command(0);                   // column start address
   ssd1306_command(WIDTH - 1);           // column end address
-  for(i=0; i<WIDTH*HEIGHT/8; i++){
-    datawrite(ptr[i]);
-  }
+  oledwrite(true, ptr, WIDTH*HEIGHT/8);
   SSD1306_SetCursor(0, 0);
 }
 
@@ -568,6 +741,7 @@ void SSD1306_PrintBMP(uint8_t xpos, uint8_t ypos, const uint8_t *ptr, uint8_t th
   if(threshold > 14){
     threshold = 14;             // only full 'on' turns pixel on
   }
+  markDirty(xpos, xpos + width - 1, (ypos - height + 1)/8, ypos/8);
   // bitmaps are encoded backwards, so start at the bottom left corner of the image
   screeny = ypos/8;
   screenx = xpos + WIDTH*screeny;
@@ -668,6 +842,7 @@ void SSD1306_drawFastHLineInternal(
     if(w > 0) { // Proceed only if width is positive
       uint8_t *pBuf = &buffer[(y / 8) * WIDTH + x],
                mask = 1 << (y & 7);
+      markDirty(x, x + w - 1, y / 8, y / 8);
       switch(color) {
        case WHITE:               while(w--) { *pBuf++ |= mask; }; break;
        case BLACK: mask = ~mask; while(w--) { *pBuf++ &= mask; }; break;
@@ -743,6 +918,7 @@ void SSD1306_drawFastVLineInternal(
       // use local byte registers for faster juggling
       uint8_t  y = __y, h = __h;
       uint8_t *pBuf = &buffer[(y / 8) * WIDTH + x];
+      markDirty(x, x, y / 8, (y + h - 1) / 8);
 
       // do the first partial byte, if necessary - this requires some masking
       uint8_t mod = (y & 7);
@@ -867,16 +1043,196 @@ static const uint8_t dlist1[] = {
   0 };
 
 void SSD1306_DisplayBuffer(void) {
+  uint32_t start = PROFILE_START();
 
                       // Column start address
   ssd1306_commandList(dlist1, sizeof(dlist1));
   ssd1306_command1(WIDTH - 1); // Column end address
 
 
-  uint16_t count = WIDTH*HEIGHT/8;
-  uint8_t *ptr   = buffer;
-// SPI
-  while(count--) datawrite(*ptr++);
+  oledwrite(true, buffer, WIDTH*HEIGHT/8);
+  clearDirty();
+  PROFILE_STOP(PROFILE_DISPLAY_BUFFER, start);
+}
+
+// The transactions of the frame being sent: a window command and a data run
+// for each changed page after SSD1306_SwapBuffers(), only frameTxn[0] after
+// SSD1306_DisplayBufferDMA(). The 6 window command bytes go out with the CPU
+// (about 14 us at 4 MHz) since DC has to be low for them, the engine's DMA
+// interrupt runs them between the pages.
+static struct spi_txn_t frameTxn[HEIGHT/4];
+static uint8_t windowList[HEIGHT/8][6];
+static const struct spi_txn_t commandTxn = {0, 0, &P9OUT, DC_BIT, false};
+static const struct spi_txn_t dataTxn = {0, 0, &P9OUT, DC_BIT, true};
+
+// last transaction of a frame done, the bus is free again
+static void frameDone(struct spi_txn_t *txn){
+  DMABusy = false;
+}
+
+/*!
+    @brief  Push data currently in RAM to SSD1306 display using the uDMA.
+    @return None (void).
+    @note   Returns as soon as the transfer is started. buffer[] must not
+            be changed until SSD1306_DMABusy() returns false. Any other
+            SSD1306 function that talks to the display will wait for the
+            transfer to finish first.
+*/
+void SSD1306_DisplayBufferDMA(void) {
+
+  ssd1306_commandList(dlist1, sizeof(dlist1));
+  ssd1306_command1(WIDTH - 1); // Column end address
+
+  DMABusy = true;
+  clearDirty();
+  frameTxn[0] = dataTxn;
+  frameTxn[0].tx = buffer;
+  frameTxn[0].txCount = WIDTH*HEIGHT/8;
+  frameTxn[0].done = frameDone;
+  oledBus_Submit(&frameTxn[0]);
+}
+
+/*!
+    @brief  Turn double buffering on or off.
+    @param  on
+            If true, drawing goes to a back buffer that is only shown by
+            SSD1306_SwapBuffers(), so the next frame can be drawn while the
+            previous one is still being sent. If false, there is a single
+            buffer (the default).
+    @return None (void).
+    @note   Switching copies the current picture so nothing is lost. The
+            buffer returned by SSD1306_GetBuffer() changes on every swap.
+*/
+void SSD1306_SetDoubleBuffer(int on) {
+  while(DMABusy);
+  if(on && !doubleBuffered){
+    front = (buffer == frame[0]) ? frame[1] : frame[0];
+    memcpy(front, buffer, WIDTH*HEIGHT/8);
+  }
+  doubleBuffered = on;
+}
+
+/*!
+    @brief  Queue the finished frame for transmission and start drawing the
+            next one.
+    @return None (void).
+    @note   Only the pages and columns changed since the last swap are sent,
+            by the DMA, and this returns as soon as the transfer starts.
+            When double buffered, the frame just drawn becomes the front
+            buffer and the application gets the other one back holding a
+            copy of the same picture, so it can keep drawing only what
+            changes. If the previous frame is still going out, this waits
+            for it first. When single buffered, buffer[] must not be drawn
+            to until SSD1306_DMABusy() returns false.
+*/
+void SSD1306_SwapBuffers(void) {
+  uint8_t *finished;
+  int i, n;
+  uint32_t start = PROFILE_START();
+
+  while(DMABusy);                     // the old front is about to become the back buffer
+  finished = buffer;
+  n = 0;
+  for(i=0; i<(HEIGHT/8); i++){
+    if(dirtyLo[i] <= dirtyHi[i]){
+      windowList[i][0] = SSD1306_PAGEADDR;
+      windowList[i][1] = i;             // page start address
+      windowList[i][2] = i;             // page end address
+      windowList[i][3] = SSD1306_COLUMNADDR;
+      windowList[i][4] = dirtyLo[i];    // column start address
+      windowList[i][5] = dirtyHi[i];    // column end address
+      frameTxn[n] = commandTxn;
+      frameTxn[n].tx = windowList[i];
+      frameTxn[n].txCount = 6;
+      frameTxn[n+1] = dataTxn;
+      frameTxn[n+1].tx = &finished[i*WIDTH + dirtyLo[i]];
+      frameTxn[n+1].txCount = dirtyHi[i] - dirtyLo[i] + 1;
+      n = n + 2;
+    }
+  }
+  clearDirty();
+  if(doubleBuffered){
+    buffer = front;
+    front = finished;
+  }
+  if(n > 0){
+    DMABusy = true;
+    frameTxn[n-1].done = frameDone;
+    for(i=0; i<n; i++){
+      oledBus_Submit(&frameTxn[i]);   // the first starts now, the rest from the DMA interrupt
+    }
+  }
+  if(doubleBuffered){
+    // the DMA only reads the front buffer, so this copy overlaps the transfer
+    memcpy(buffer, front, WIDTH*HEIGHT/8);
+  }
+  PROFILE_STOP(PROFILE_SWAP_BUFFERS, start);
+}
+
+/*!
+    @brief  Check whether a DMA frame transfer is still in progress.
+    @return true while buffer[] is being sent, false once it is safe to
+            change buffer[] or send anything else to the display.
+*/
+int SSD1306_DMABusy(void) {
+  return DMABusy;
+}
+
+/*!
+    @brief  Push only the parts of RAM that changed since the last refresh
+            to the SSD1306 display.
+    @return None (void).
+    @note   Each changed page gets its own PAGEADDR/COLUMNADDR window
+            covering only its changed columns, so a screen where a few
+            digits change costs tens of bytes instead of 1024. Changes
+            are tracked by the drawing functions that write to buffer[];
+            if buffer[] is written directly through SSD1306_GetBuffer(),
+            call SSD1306_MarkDirty() for the area that was changed.
+*/
+void SSD1306_DisplayDirty(void) {
+  uint8_t page;
+
+  for(page=0; page<(HEIGHT/8); page++){
+    if(dirtyLo[page] <= dirtyHi[page]){
+      ssd1306_command(SSD1306_PAGEADDR);
+      ssd1306_command(page);            // page start address
+      ssd1306_command(page);            // page end address
+      ssd1306_command(SSD1306_COLUMNADDR);
+      ssd1306_command(dirtyLo[page]);   // column start address
+      ssd1306_command(dirtyHi[page]);   // column end address
+      oledwrite(true, &buffer[page*WIDTH + dirtyLo[page]], dirtyHi[page] - dirtyLo[page] + 1);
+    }
+  }
+  clearDirty();
+}
+
+/*!
+    @brief  Flag part of the RAM buffer as changed for SSD1306_DisplayDirty().
+    @param  x  Leftmost column of the changed area.
+    @param  y  Topmost row of the changed area.
+    @param  w  Width of the changed area, in pixels.
+    @param  h  Height of the changed area, in pixels.
+    @return None (void).
+    @note   Only needed after writing to buffer[] directly; the drawing
+            functions already do this. Coordinates are unrotated (buffer
+            layout).
+*/
+void SSD1306_MarkDirty(int16_t x, int16_t y, int16_t w, int16_t h) {
+  if((w > 0) && (h > 0)){
+    markDirty(x, x + w - 1, y/8, (y + h - 1)/8);
+  }
+}
+
+// OLED DMA channel done: the last byte has been loaded into TXBUF. It may
+// still be shifting out, but the engine waits on the eUSCI BUSY flag before
+// touching DC, so the run is not cut short. Then it starts the next one.
+// Worst case time in here at the 4 MHz bit clock (BRW = 3): the BUSY wait
+// is 2 bytes, 4 us, and the next window's command (header and 6 bytes,
+// under SPI_DMA_MIN so polled) is about 14 us more before its data run is
+// handed to the DMA, so under 20 us (about 1000 MCLK cycles) per interrupt.
+void DMA_INT1_IRQHandler(void) {
+  DMA_ClearFlag(OLED_DMA_CH);
+  oledBus_DMADone();
 }
 
 // SCROLLING FUNCTIONS -----------------------------------------------------
@@ -1055,6 +1411,23 @@ void SSD1306_Dim(int dim) {
 
 }
 
+/*!
+    @brief  Turn the panel off and on.
+    @param  sleep
+            true to switch the panel off (its charge pump and all), false
+            to switch it back on.
+    @return None (void).
+    @note   The display RAM keeps its contents while off, so the same
+            picture comes back without a refresh. Waits for a DMA frame
+            to finish first.
+*/
+void SSD1306_Sleep(int sleep) {
+
+  while(DMABusy);                     // let the frame in flight land first
+  ssd1306_command1(sleep ? SSD1306_DISPLAYOFF : SSD1306_DISPLAYON);
+
+}
+
 /*
  * This deprecated function maintains a cursor and moves it
  * with this function.  The new function synchronizes this
@@ -1145,6 +1518,8 @@ void SSD1306_SetCursor(uint16_t newX, uint16_t newY){
 // Outputs: none
 // Assumes: OLED is in horizontal addressing mode (command 0x20, 0x00)
 void SSD1306_OutChar(char data){int i;
+  uint8_t glyph[6];
+  uint32_t start = PROFILE_START();
   if((data == 0x0A) || (data == 0x0D)){ // line feed or carriage return
     // go to the first column
     CurrentX = 0;
@@ -1199,10 +1574,12 @@ void SSD1306_OutChar(char data){int i;
       }
     }
     for(i=0; i<5; i=i+1){
-      datawrite(ASCII[data - 0x20][i]);
+      glyph[i] = ASCII[data - 0x20][i];
     }
-    datawrite(0x00);            // blank vertical line padding
+    glyph[5] = 0x00;            // blank vertical line padding
+    oledwrite(true, glyph, 6);
   }
+  PROFILE_STOP(PROFILE_OUT_CHAR, start);
 }
 
 //********SSD1306_OutString*****************
@@ -1372,41 +1749,41 @@ void SSD1306_OutUFix1(uint16_t n){
   message[4] = 0;
   SSD1306_OutString(message);
 }
-//********SSD1306_OutSFix1*****************
-// Output a 16-bit number in signed 4-digit fixed point, 0.1 resolution
-// numbers -9999 to 9999 printed as "-999.0" to " 999.9"
-// Inputs: n  32-bit signed number
-// Outputs: none
-void SSD1306_OutSFix1(int32_t n){
-  char message[8];
+// n/10 without a divide for 0 <= n < 81920: 0xCCCD/2^19 is 1/10 rounded up,
+// and the error stays below one tenth of a step over that range
+static uint32_t div10(uint32_t n){
+  return (n*0xCCCD) >> 19;
+}
+// Format n for SSD1306_OutSFix1 and SSD1306_BufOutSFix1 into message (7 bytes)
+// The digits come from reciprocal multiplies, no division or modulo.
+void SSD1306_FormatSFix1(char *message, int32_t n){uint32_t u, q;
   if(n<-9999) n=-9999;
   if(n>9999)  n=9999;
   if(n<0){
     message[0] = '-';
-    n = -n; // now positive
+    u = -n; // now positive
   }else{
     message[0] = ' ';
+    u = n;
   }
-  if(n>=1000){  // 1000 to 9999
-    message[1] = (n/1000+'0'); /* hundreds digit */
-    n = n%1000; // the rest
-    message[2] = (n/100+'0'); /* tens digit */
-    n = n%100;  // the rest
-  }else{
-    if(n>=100){  // 100 to 999
-      message[1] = ' '; /* n is between 0.0 and 9.9 */
-      message[2] = (n/100+'0'); /* tens digit */
-      n = n%100; //the rest
-    }else { // 0 to 99
-      message[1] = ' '; /* n is between 0.0 and 9.9 */
-      message[2] = ' ';
-    }
-  }
-  message[3] = (n/10+'0'); /* ones digit */
-  n = n%10; //the rest
+  q = div10(u);
+  message[5] = (u - q*10 + '0');  /* tenths digit */
   message[4] = '.';
-  message[5] = (n+'0'); /* tenths digit */
+  u = div10(q);
+  message[3] = (q - u*10 + '0');  /* ones digit */
+  q = div10(u);
+  message[2] = (u >= 1) ? (u - q*10 + '0') : ' '; /* tens digit */
+  message[1] = (q >= 1) ? (q + '0') : ' ';        /* hundreds digit */
   message[6] = 0;
+}
+//********SSD1306_OutSFix1*****************
+// Output a 16-bit number in signed 4-digit fixed point, 0.1 resolution
+// numbers -9999 to 9999 printed as "-999.0" to " 999.9"
+// Inputs: n  32-bit signed number
+// Outputs: none
+void SSD1306_OutSFix1(int32_t n){
+  char message[8];
+  SSD1306_FormatSFix1(message, n);
   SSD1306_OutString(message);
 }
 
@@ -1457,3 +1834,144 @@ void SSD1306_OutUDec2(uint32_t n){
     }
   }
 }
+
+// BUFFERED TEXT ------------------------------------------------------------
+// Same character grid and wrapping as SSD1306_SetCursor/SSD1306_OutChar, but
+// the characters are written into buffer[] instead of straight to the OLED,
+// so a whole screen of text costs one SSD1306_DisplayDirty() or
+// SSD1306_SwapBuffers() instead of commands and data for every character.
+// Rows are pages, so each glyph column is exactly one byte of buffer[] and
+// is copied in whole (rotation is not applied, same as SSD1306_OutChar).
+
+static uint16_t BufX = 0, BufY = 0;   // column (pixels) and page of the text cursor
+
+//********SSD1306_BufSetCursor*****************
+// Move the buffered text cursor to the desired X- and Y-position.
+// X=0 is the leftmost column.  Y=0 is the top row.
+// Inputs: newX  new X-position of the cursor (0<=newX<=20)
+//         newY  new Y-position of the cursor (0<=newY<=7)
+// Outputs: none
+void SSD1306_BufSetCursor(uint16_t newX, uint16_t newY){
+  if((newX > ((WIDTH/6) - 1)) || (newY > ((HEIGHT/8) - 1))){
+    return;                             // bad input; do nothing
+  }
+  BufX = newX*6;
+  BufY = newY;
+}
+
+// one character for SSD1306_BufOutChar() and SSD1306_BufOutRun(), not
+// profiled so a run isn't counted once for itself and again per character
+static void bufOutChar(char data){int i;
+  uint8_t *pBuf;
+  uint8_t col, changed = false;
+  if((data == 0x0A) || (data == 0x0D)){ // line feed or carriage return
+    BufX = 0;
+    BufY = BufY + 1;
+    if(BufY > ((HEIGHT/8) - 1)){
+      BufY = 0;
+    }
+  }else if((data >= 0x20) && (data <= 0x7F)){ // printable character
+    if((BufX + 6) > (WIDTH - (WIDTH%6))){  // no room left on this row
+      BufX = 0;
+      BufY = BufY + 1;
+      if(BufY > ((HEIGHT/8) - 1)){
+        BufY = 0;
+      }
+    }
+    pBuf = &buffer[BufY*WIDTH + BufX];
+    for(i=0; i<6; i=i+1){
+      col = (i < 5) ? ASCII[data - 0x20][i] : 0x00; // blank vertical line padding
+      if(pBuf[i] != col){
+        pBuf[i] = col;
+        changed = true;
+      }
+    }
+    if(changed){
+      markDirty(BufX, BufX + 5, BufY, BufY);
+    }
+    BufX = BufX + 6;
+  }
+}
+
+//********SSD1306_BufOutChar*****************
+// Draw a character into the RAM buffer at the buffered text cursor,
+// with one blank column of padding to its right, and advance the cursor.
+// Wraps to the next row, and from the last row back to the top.
+// Only the bytes that actually change are marked dirty.
+// Inputs: data  character to print
+// Outputs: none
+void SSD1306_BufOutChar(char data){
+  uint32_t start = PROFILE_START();
+  bufOutChar(data);
+  PROFILE_STOP(PROFILE_BUF_OUT_CHAR, start);
+}
+
+//********SSD1306_BufOutRun*****************
+// Draw count characters into the RAM buffer at the buffered text cursor
+// and advance it, like count calls to SSD1306_BufOutChar(). When they fit
+// on the row, ' ' to '9' (numbers, sign and point) are copied from the
+// pre-packed glyphRuns[] a whole character at a time and the changed
+// columns are marked dirty once for the run. Anything else goes through
+// the single character path, which may move the cursor to another row
+// (CR, LF) or not at all (other control characters).
+// Inputs: text   characters to print, no terminator needed
+//         count  how many
+// Outputs: none
+void SSD1306_BufOutRun(const char *text, uint16_t count){int i;
+  uint8_t *pBuf;
+  int16_t lo = WIDTH, hi = -1;
+  uint32_t start = PROFILE_START();
+  if((BufX + 6*count) > (WIDTH - (WIDTH%6))){  // wraps, the slow way
+    for(i=0; i<count; i=i+1){
+      bufOutChar(text[i]);
+    }
+    PROFILE_STOP(PROFILE_BUF_OUT_RUN, start);
+    return;
+  }
+  pBuf = &buffer[BufY*WIDTH + BufX];
+  for(i=0; i<count; i=i+1){
+    if((text[i] >= RUN_FIRST) && (text[i] <= RUN_LAST)){
+      if(memcmp(pBuf, glyphRuns[text[i] - RUN_FIRST], 6) != 0){
+        memcpy(pBuf, glyphRuns[text[i] - RUN_FIRST], 6);
+        if(lo == WIDTH) lo = BufX;
+        hi = BufX + 5;
+      }
+      BufX = BufX + 6;
+      pBuf = pBuf + 6;
+    }else{
+      if(hi >= 0){                      // the cursor may leave this row
+        markDirty(lo, hi, BufY, BufY);
+        lo = WIDTH;
+        hi = -1;
+      }
+      bufOutChar(text[i]);              // marks itself
+      pBuf = &buffer[BufY*WIDTH + BufX];  // wherever it left the cursor
+    }
+  }
+  if(hi >= 0){
+    markDirty(lo, hi, BufY, BufY);
+  }
+  PROFILE_STOP(PROFILE_BUF_OUT_RUN, start);
+}
+
+//********SSD1306_BufOutString*****************
+// Draw a string into the RAM buffer at the buffered text cursor.
+// Inputs: ptr  pointer to NULL-terminated ASCII string
+// Outputs: none
+void SSD1306_BufOutString(char *ptr){
+  while(*ptr){
+    SSD1306_BufOutChar(*ptr);
+    ptr++;
+  }
+}
+
+//********SSD1306_BufOutSFix1*****************
+// Draw a number into the RAM buffer in the same format as SSD1306_OutSFix1
+// numbers -9999 to 9999 printed as "-999.9" to " 999.9"
+// Inputs: n  32-bit signed number
+// Outputs: none
+void SSD1306_BufOutSFix1(int32_t n){
+  char message[8];
+  SSD1306_FormatSFix1(message, n);
+  SSD1306_BufOutRun(message, 6);
+}
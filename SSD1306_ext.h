@@ -0,0 +1,54 @@
+// SSD1306_ext.h
+// Functions added to this project's copy of SSD1306.c that are not in
+// ../inc/SSD1306.h. Include after ../inc/SSD1306.h.
+
+// REFRESH DISPLAY ---------------------------------------------------------
+
+// Start sending buffer[] to the display over the uDMA and return immediately.
+// buffer[] must not be changed until SSD1306_DMABusy() returns false.
+void SSD1306_DisplayBufferDMA(void);
+
+// true while a SSD1306_DisplayBufferDMA() transfer is in progress
+int SSD1306_DMABusy(void);
+
+// Send only the page/column windows of buffer[] that the drawing functions
+// changed since the last refresh.
+void SSD1306_DisplayDirty(void);
+
+// Flag an area of buffer[] as changed after writing it through
+// SSD1306_GetBuffer(). Unrotated pixel coordinates.
+void SSD1306_MarkDirty(int16_t x, int16_t y, int16_t w, int16_t h);
+
+// Turn the front/back buffer pair on (true) or off (false, the default).
+void SSD1306_SetDoubleBuffer(int on);
+
+// Send the changed parts of the finished frame by DMA and return. When
+// double buffered, drawing continues in the other buffer, which starts
+// out as a copy of the finished frame.
+void SSD1306_SwapBuffers(void);
+
+// Switch the panel off (true) to save power, or back on (false) showing
+// what it showed before. Waits for a DMA frame in flight, no refresh needed.
+void SSD1306_Sleep(int sleep);
+
+// BUFFERED TEXT ------------------------------------------------------------
+// Same as SSD1306_SetCursor/OutChar/OutString/OutSFix1, but drawn into
+// buffer[]. Nothing is sent until SSD1306_DisplayDirty() or
+// SSD1306_SwapBuffers().
+
+void SSD1306_BufSetCursor(uint16_t newX, uint16_t newY);
+void SSD1306_BufOutChar(char data);
+void SSD1306_BufOutString(char *ptr);
+void SSD1306_BufOutSFix1(int32_t n);
+
+// count characters of text at the buffered cursor, numbers copied as
+// pre-packed 6 column runs. Same result as count BufOutChar() calls.
+void SSD1306_BufOutRun(const char *text, uint16_t count);
+
+// The " 999.9" text SSD1306_OutSFix1/BufOutSFix1 draw, into message (7 bytes).
+void SSD1306_FormatSFix1(char *message, int32_t n);
+
+#ifdef BENCHMARK
+// SSD1306_DrawChar the DrawPixel way, for bench_main.c to compare against.
+void SSD1306_DrawCharPixels(int16_t x, int16_t y, char letter, uint16_t color);
+#endif
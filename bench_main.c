@@ -0,0 +1,214 @@
+// *****************************************************************************
+// Name: Final Project
+// File: bench_main.c
+// Author: Janos Banoczi-Ruof
+// Driver benchmarks, built instead of the application when BENCHMARK is defined
+// (Project Properties > Build > Arm Compiler > Predefined Symbols, BENCHMARK).
+// Same wiring as final_main.c. Results go out of the backchannel UART at
+// 115200 as CSV, one row per measurement:
+//   benchmark,param,runs,us_per_op,bytes_per_s
+// us_per_op has 3 decimals, bytes_per_s is 0 where no bus traffic is involved.
+// Times come from the DWT cycle counter and include the SysTick interrupt.
+// *****************************************************************************
+#ifdef BENCHMARK
+// standard includes
+#include "msp.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+// inc folder includes
+#include "../inc/Clock.h"
+#include "../inc/CortexM.h"
+#include "../inc/SSD1306.h"
+#include "SSD1306_ext.h"
+// local/custom includes
+#include "LSM9DS1.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "profile.h"
+
+#define BENCH_RUNS      200     // repetitions of the fast operations
+#define BENCH_FRAMES    20      // repetitions of the full display refreshes
+#define SFIX1_FIELDS    3       // numeric fields a screen changes per update
+#define BENCH_HEADER    "benchmark,param,runs,us_per_op,bytes_per_s\r\n"
+
+// AG output registers read one at a time by the single register benchmark
+static const uint8_t agRegisters[] = {0x15, 0x18, 0x1A, 0x1C, 0x28, 0x2A, 0x2C};  // TEMP, G X/Y/Z, XL X/Y/Z
+static const uint16_t benchDividers[] = {LSM9DS1_SPI_DIVIDER, 3, 6, 12, 120};
+
+/**
+ * Send one CSV row, waiting for a free telemetry frame if the UART is behind
+ * @param {const char*} name benchmark name
+ * @param {uint32_t} param what was varied, e.g. the SPI divider, 0 if nothing
+ * @param {uint32_t} runs operations timed
+ * @param {uint32_t} cycles total CPU cycles for all runs
+ * @param {uint32_t} bytes bus bytes moved per operation, 0 if none or it varies
+ * @returns void
+ */
+void report(const char *name, uint32_t param, uint32_t runs, uint32_t cycles, uint32_t bytes){
+    char line[80];
+    uint64_t nsPerOp = ((uint64_t)cycles * 1000000000ULL) / ((uint64_t)Clock_GetFreq() * runs);
+    uint32_t bytesPerS = (nsPerOp > 0) ? (uint32_t)(((uint64_t)bytes * 1000000000ULL) / nsPerOp) : 0;
+    int length;
+
+    length = snprintf(line, sizeof(line), "%s,%lu,%lu,%lu.%03lu,%lu\r\n", name, (unsigned long)param,
+                      (unsigned long)runs, (unsigned long)(nsPerOp / 1000), (unsigned long)(nsPerOp % 1000),
+                      (unsigned long)bytesPerS);
+    while (!Telemetry_SendText(line, (uint16_t)length)) {}
+}
+
+/**
+ * SPI_transfer(), read_SPI() and single register vs burst AG reads at every bus divider
+ * the sensor answers at
+ * @returns void
+ */
+void benchSensor(void){
+    struct ag_sample_t sample;
+    uint16_t oldDivider = LSM9DS1_GetBusDivider();
+    uint8_t raw[2];
+    uint32_t start;
+    uint16_t i, d, r;
+
+    for (d = 0; d < sizeof(benchDividers) / sizeof(benchDividers[0]); d++) {
+        LSM9DS1_SetBusDivider(benchDividers[d]);
+        if (!LSM9DS1_CheckID()) {
+            continue;   // too fast for this sensor and wiring, nothing to measure
+        }
+        start = DWT->CYCCNT;
+        for (i = 0; i < BENCH_RUNS; i++) {
+            SPI_transfer(0);    // no CS asserted, the sensor ignores it
+        }
+        report("spi_transfer", benchDividers[d], BENCH_RUNS, DWT->CYCCNT - start, 1);
+
+        start = DWT->CYCCNT;
+        for (i = 0; i < BENCH_RUNS; i++) {
+            read_SPI(AG, 0x0F, raw, 1);     // WHO_AM_I
+        }
+        report("read_spi_1", benchDividers[d], BENCH_RUNS, DWT->CYCCNT - start, 2);
+
+        start = DWT->CYCCNT;
+        for (i = 0; i < BENCH_RUNS; i++) {
+            for (r = 0; r < sizeof(agRegisters); r++) {
+                read_SPI(AG, agRegisters[r], raw, 2);
+            }
+        }
+        report("ag_single", benchDividers[d], BENCH_RUNS, DWT->CYCCNT - start, 3 * sizeof(agRegisters));
+
+        start = DWT->CYCCNT;
+        for (i = 0; i < BENCH_RUNS; i++) {
+            LSM9DS1_ReadAGBurst(&sample);
+        }
+        report("ag_burst", benchDividers[d], BENCH_RUNS, DWT->CYCCNT - start, 17);  // 2 reads, 15 data bytes
+    }
+    LSM9DS1_SetBusDivider(oldDivider);
+}
+
+/**
+ * Draw SFIX1_FIELDS numbers the way the state screens do
+ * @param {int32_t} n first one, the others follow it
+ * @returns void
+ */
+void drawFields(int32_t n){
+    uint8_t f;
+
+    for (f = 0; f < SFIX1_FIELDS; f++) {
+        SSD1306_BufSetCursor(8, 2 + 2 * f);
+        SSD1306_BufOutSFix1(n + f);
+    }
+}
+
+/**
+ * Full, dirty only and DMA refreshes, glyph drawing and number formatting
+ * @returns void
+ */
+void benchDisplay(void){
+    char message[8];
+    uint32_t start, cycles;
+    uint16_t i;
+
+    SSD1306_ClearBuffer();
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        SSD1306_DisplayBuffer();
+    }
+    report("display_full", 0, BENCH_FRAMES, DWT->CYCCNT - start, 1024);
+
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        SSD1306_DisplayBufferDMA();
+        while (SSD1306_DMABusy()) {}
+    }
+    report("display_dma", 0, BENCH_FRAMES, DWT->CYCCNT - start, 1024);
+
+    // only the fields change, as on the sensor screens. drawing is left out of the time
+    cycles = 0;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        drawFields(i * 11);
+        start = DWT->CYCCNT;
+        SSD1306_DisplayDirty();
+        cycles += DWT->CYCCNT - start;
+    }
+    report("display_dirty", SFIX1_FIELDS, BENCH_FRAMES, cycles, 0);
+
+    // the same characters the old way (35 SSD1306_DrawPixel calls) and with the column blits
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_RUNS; i++) {
+        SSD1306_DrawCharPixels((i % 21) * 6, ((i / 21) % 8) * 8, 'A' + (i % 26), WHITE);
+    }
+    report("draw_char_pixels", 0, BENCH_RUNS, DWT->CYCCNT - start, 0);
+
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_RUNS; i++) {
+        SSD1306_DrawChar((i % 21) * 6, ((i / 21) % 8) * 8, 'A' + (i % 26), WHITE);
+    }
+    report("draw_char", 0, BENCH_RUNS, DWT->CYCCNT - start, 0);
+
+    SSD1306_BufSetCursor(0, 0);
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_RUNS; i++) {
+        SSD1306_BufOutChar('A' + (i % 26));
+    }
+    report("buf_out_char", 0, BENCH_RUNS, DWT->CYCCNT - start, 0);
+
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_RUNS; i++) {
+        SSD1306_FormatSFix1(message, (int32_t)(i * 97) - 9999);
+    }
+    report("format_sfix1", 0, BENCH_RUNS, DWT->CYCCNT - start, 0);
+
+    SSD1306_BufSetCursor(0, 0);
+    start = DWT->CYCCNT;
+    for (i = 0; i < BENCH_RUNS; i++) {
+        SSD1306_BufOutSFix1((int32_t)(i * 97) - 9999);
+    }
+    report("buf_out_sfix1", 0, BENCH_RUNS, DWT->CYCCNT - start, 0);
+}
+
+// main
+void main(void){
+    WDT_A->CTL = WDT_A_CTL_PW | WDT_A_CTL_HOLD;     // stop watchdog timer
+    Clock_Init48MHz();
+    Scheduler_Init();
+    Profile_Init();     // starts CYCCNT
+    Telemetry_Init(TELEMETRY_ASCII);
+    EnableInterrupts();
+
+    SSD1306_Init(SSD1306_SWITCHCAPVCC);
+    SSD1306_ClearBuffer();
+    SSD1306_DisplayBuffer();
+    Scheduler_Sleep(500);
+
+    while (!Telemetry_SendText(BENCH_HEADER, sizeof(BENCH_HEADER) - 1)) {}
+    if (LSM9DS1_Init()) {
+        benchSensor();
+    }
+    benchDisplay();
+    while (!Telemetry_SendText("done\r\n", 6)) {}
+
+    SSD1306_ClearBuffer();
+    SSD1306_BufSetCursor(0, 0);
+    SSD1306_BufOutString("Benchmark done");
+    SSD1306_DisplayBuffer();
+    while (1) {}
+}
+#endif
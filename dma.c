@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "msp.h"
+#include "dma.h"
+
+// The uDMA only needs one channel control structure per channel in basic mode, but the
+// table it points to must have room for the primary and alternate structures of all 8
+// channels and be aligned to its size. TI's examples align it to 1024, so we do too.
+// see TRM chapter 11 (DMA)
+
+#define DMA_NUM_CHANNELS    8
+
+struct dma_ctl_t {
+    volatile const void *srcEnd;    // pointer to the last source byte
+    volatile void *dstEnd;          // pointer to the last destination byte
+    uint32_t control;               // transfer size, increments and mode
+    uint32_t spare;
+};
+
+#pragma DATA_ALIGN(dmaControlTable, 1024)
+static volatile struct dma_ctl_t dmaControlTable[DMA_NUM_CHANNELS * 2];
+
+// channel control word fields
+#define DMA_DST_INC_8       0x00000000  // destination address increments by a byte
+#define DMA_DST_INC_NONE    0xC0000000  // destination address is fixed
+#define DMA_SRC_INC_8       0x00000000  // source address increments by a byte
+#define DMA_SRC_INC_NONE    0x0C000000  // source address is fixed
+#define DMA_SIZE_8          0x00000000  // source and destination data are bytes
+#define DMA_ARB_1           0x00000000  // rearbitrate after every item (one per trigger)
+#define DMA_MODE_BASIC      0x00000001  // stop when the count runs out
+#define DMA_N_MINUS_1(n)    (((uint32_t)(n) - 1) << 4)
+
+static bool dmaInitialized = false;
+
+// safe to call from every driver that uses a channel, only the first call does anything
+void DMA_Init(void){
+    if (dmaInitialized) {
+        return;
+    }
+    DMA_Control->CFG = DMA_CFG_MASTEN;                  // enable the controller
+    DMA_Control->CTLBASE = (uint32_t)dmaControlTable;   // point it at the control table
+    dmaInitialized = true;
+}
+
+static void DMA_Start(uint8_t channel, uint8_t source, volatile const void *srcEnd, volatile void *dstEnd, uint32_t control){
+    dmaControlTable[channel].srcEnd = srcEnd;
+    dmaControlTable[channel].dstEnd = dstEnd;
+    dmaControlTable[channel].control = control;
+
+    DMA_Channel->CH_SRCCFG[channel] = source;   // select the trigger
+    DMA_Control->ALTCLR = (1 << channel);       // use the primary structure
+    DMA_Control->USEBURSTCLR = (1 << channel);  // respond to single requests
+    DMA_Control->REQMASKCLR = (1 << channel);   // let the trigger through
+    // the eUSCI triggers are the level of UCTXIFG/UCRXIFG, so a tx channel starts
+    // as soon as it is enabled if the tx buffer is already empty
+    DMA_Control->ENASET = (1 << channel);
+}
+
+void DMA_StartTx(uint8_t channel, uint8_t source, const uint8_t *src, volatile void *txbuf, uint16_t count){
+    DMA_Start(channel, source, src + count - 1, txbuf,
+              DMA_DST_INC_NONE | DMA_SRC_INC_8 | DMA_SIZE_8 | DMA_ARB_1 | DMA_N_MINUS_1(count) | DMA_MODE_BASIC);
+}
+
+void DMA_StartRx(uint8_t channel, uint8_t source, volatile const void *rxbuf, uint8_t *dst, uint16_t count){
+    DMA_Start(channel, source, rxbuf, dst + count - 1,
+              DMA_DST_INC_8 | DMA_SRC_INC_NONE | DMA_SIZE_8 | DMA_ARB_1 | DMA_N_MINUS_1(count) | DMA_MODE_BASIC);
+}
+
+void DMA_EnableInterrupt(uint8_t intNum, uint8_t channel){
+    IRQn_Type irq;
+
+    if (intNum == 1) {
+        DMA_Channel->INT1_SRCCFG = DMA_INT1_SRCCFG_EN | channel;
+        irq = DMA_INT1_IRQn;
+    } else if (intNum == 2) {
+        DMA_Channel->INT2_SRCCFG = DMA_INT2_SRCCFG_EN | channel;
+        irq = DMA_INT2_IRQn;
+    } else {
+        DMA_Channel->INT3_SRCCFG = DMA_INT3_SRCCFG_EN | channel;
+        irq = DMA_INT3_IRQn;
+    }
+    DMA_ClearFlag(channel);
+    NVIC->ISER[irq >> 5] = (1 << (irq & 0x1F));     // enable the DMA_INTn interrupt
+}
+
+void DMA_ClearFlag(uint8_t channel){
+    DMA_Channel->INT0_CLRFLG = (1 << channel);
+}
+
+// a basic mode channel disables itself once its last item has been moved
+uint8_t DMA_IsEnabled(uint8_t channel){
+    return (DMA_Control->ENASET & (1 << channel)) != 0;
+}
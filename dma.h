@@ -0,0 +1,21 @@
+#include <stdint.h>
+
+// uDMA channel/trigger pairs used in this project (see datasheet table 6-39, DMA sources)
+#define DMA_CH0_EUSCIA0TX   0, 1
+#define DMA_CH2_EUSCIB1TX0  2, 2
+#define DMA_CH3_EUSCIB1RX0  3, 2
+#define DMA_CH6_EUSCIA3TX   6, 1
+
+void DMA_Init(void);
+
+// memory to peripheral (tx buffer) byte transfer, count 1-1024. Source increments, destination fixed
+void DMA_StartTx(uint8_t channel, uint8_t source, const uint8_t *src, volatile void *txbuf, uint16_t count);
+
+// peripheral (rx buffer) to memory byte transfer, count 1-1024. Source fixed, destination increments
+void DMA_StartRx(uint8_t channel, uint8_t source, volatile const void *rxbuf, uint8_t *dst, uint16_t count);
+
+// routes the completion of channel to DMA_INT<intNum>_IRQHandler, intNum is 1-3
+void DMA_EnableInterrupt(uint8_t intNum, uint8_t channel);
+
+void DMA_ClearFlag(uint8_t channel);
+uint8_t DMA_IsEnabled(uint8_t channel);
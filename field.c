@@ -0,0 +1,39 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "field.h"
+#include "SSD1306_ext.h"
+
+void Field_Init(struct field_t *field, uint8_t column, uint8_t row){
+    field->column = column;
+    field->row = row;
+    field->length = 0;
+    field->text[0] = 0;
+}
+
+// only the characters from the first difference on are drawn again, as one run
+bool Field_SetText(struct field_t *field, const char *text){
+    uint8_t i, length, end;
+
+    for (i = 0; (i < FIELD_MAX_CHARS) && text[i] && (text[i] == field->text[i]); i++) {
+    }
+    if ((i == FIELD_MAX_CHARS) || ((text[i] == 0) && (field->text[i] == 0))) {
+        return false;   // same as what is there
+    }
+    for (length = i; (length < FIELD_MAX_CHARS) && text[length]; length++) {
+        field->text[length] = text[length];
+    }
+    for (end = length; end < field->length; end++) {
+        field->text[end] = ' ';     // blanks what is left of the old text
+    }
+    SSD1306_BufSetCursor(field->column + i, field->row);
+    SSD1306_BufOutRun(&field->text[i], end - i);
+    field->text[length] = 0;
+    field->length = length;
+    return true;
+}
+
+bool Field_SetSFix1(struct field_t *field, int32_t n){
+    char message[8];
+    SSD1306_FormatSFix1(message, n);
+    return Field_SetText(field, message);
+}
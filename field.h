@@ -0,0 +1,23 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Retained text fields on the buffered SSD1306 text grid (21 columns x 8 rows). A field keeps the
+// text it last drew and only draws again when a new value comes out different, so a screen whose
+// numbers hold still costs no drawing and, through the dirty tracking, no OLED traffic.
+// Labels and units are drawn once on state entry with SSD1306_BufOutString(), then only the
+// fields are updated on every pass.
+
+#define FIELD_MAX_CHARS 21  // a whole row
+
+struct field_t {
+    uint8_t column, row;
+    uint8_t length;                     // characters on screen now
+    char text[FIELD_MAX_CHARS + 1];     // what is on screen now
+};
+
+// places the field and forgets what it showed, call on state entry after SSD1306_ClearBuffer()
+void Field_Init(struct field_t *field, uint8_t column, uint8_t row);
+
+// both return true if the field was redrawn. shorter text blanks what is left of the old one
+bool Field_SetText(struct field_t *field, const char *text);
+bool Field_SetSFix1(struct field_t *field, int32_t n);     // SSD1306_BufOutSFix1() format
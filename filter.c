@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include "filter.h"
+
+#define IIR_FRACTION 8
+
+void Boxcar_Init(struct boxcar_t *filter, uint8_t channels, uint8_t stride, uint16_t factor){
+    uint8_t c;
+
+    if (channels > FILTER_MAX_CHANNELS) {
+        channels = FILTER_MAX_CHANNELS;
+    }
+    for (c = 0; c < FILTER_MAX_CHANNELS; c++) {
+        filter->sum[c] = 0;
+    }
+    filter->count = 0;
+    filter->factor = (factor == 0) ? 1 : factor;
+    filter->channels = channels;
+    filter->stride = (stride < channels) ? channels : stride;
+}
+
+// Decimates frames input frames of block in place: the averages are written over the front of block,
+// which never overtakes the input still to be read. returns how many output frames are there now.
+// a partial group at the end is carried over into the next call. the unfiltered tail of an output
+// frame is taken from the last input frame of its group
+uint16_t Boxcar_Process(struct boxcar_t *filter, int16_t *block, uint16_t frames){
+    uint16_t in, out = 0;
+    uint8_t c;
+    uint8_t channels = filter->channels;
+    uint8_t stride = filter->stride;
+    int16_t half = filter->factor / 2;
+
+    for (in = 0; in < frames; in++) {
+        for (c = 0; c < channels; c++) {
+            filter->sum[c] += block[in * stride + c];
+        }
+        if (++filter->count < filter->factor) {
+            continue;
+        }
+        for (c = 0; c < channels; c++) {
+            // rounded to nearest, away from zero at the halfway point
+            if (filter->sum[c] >= 0) {
+                block[out * stride + c] = (int16_t)((filter->sum[c] + half) / filter->factor);
+            } else {
+                block[out * stride + c] = (int16_t)((filter->sum[c] - half) / filter->factor);
+            }
+            filter->sum[c] = 0;
+        }
+        for (; c < stride; c++) {
+            block[out * stride + c] = block[in * stride + c];
+        }
+        filter->count = 0;
+        out++;
+    }
+    return out;
+}
+
+void IIR_Init(struct iir_t *filter, uint8_t channels, uint8_t stride, uint8_t shift){
+    if (channels > FILTER_MAX_CHANNELS) {
+        channels = FILTER_MAX_CHANNELS;
+    }
+    filter->channels = channels;
+    filter->stride = (stride < channels) ? channels : stride;
+    filter->shift = shift;
+    filter->primed = 0;
+}
+
+// Smooths frames frames of block in place, a multiply-free shift per channel per frame.
+// shift 0 passes the input through, each step up halves the cutoff
+void IIR_Process(struct iir_t *filter, int16_t *block, uint16_t frames){
+    uint16_t f;
+    uint8_t c;
+    uint8_t channels = filter->channels;
+    uint8_t stride = filter->stride;
+    int32_t x;
+
+    for (f = 0; f < frames; f++) {
+        for (c = 0; c < channels; c++) {
+            x = (int32_t)block[f * stride + c] << IIR_FRACTION;
+            if (!filter->primed) {
+                filter->y[c] = x;   // start from the first value instead of ramping up from 0
+            } else {
+                filter->y[c] += (x - filter->y[c]) >> filter->shift;
+            }
+            block[f * stride + c] = (int16_t)((filter->y[c] + (1 << (IIR_FRACTION - 1))) >> IIR_FRACTION);
+        }
+        filter->primed = 1;
+    }
+}
@@ -0,0 +1,32 @@
+#include <stdint.h>
+
+// Per channel filters for blocks of int16_t frames, e.g. an array of struct ag_sample_t (7 channels)
+// or of struct imu_sample_t (10 channels) cast to int16_t *. A frame is stride int16_t long and its
+// first channels int16_t are filtered, anything after them (a timestamp) is carried along unfiltered.
+// Both work in place and keep their state between blocks, so a stream can be fed in any block sizes
+
+#define FILTER_MAX_CHANNELS 10
+
+// boxcar (first order CIC) decimator: every factor input frames become one frame of their average
+struct boxcar_t {
+    int32_t sum[FILTER_MAX_CHANNELS];
+    uint16_t count;     // input frames in sum so far
+    uint16_t factor;
+    uint8_t channels;
+    uint8_t stride;     // int16_t per frame, channels or more
+};
+
+// first order IIR low pass, y += (x - y) / 2^shift. kept with 8 fraction bits so small steps aren't lost
+struct iir_t {
+    int32_t y[FILTER_MAX_CHANNELS];
+    uint8_t shift;
+    uint8_t channels;
+    uint8_t stride;
+    uint8_t primed;     // 0 until the first frame, which is taken as is
+};
+
+void Boxcar_Init(struct boxcar_t *filter, uint8_t channels, uint8_t stride, uint16_t factor);
+uint16_t Boxcar_Process(struct boxcar_t *filter, int16_t *block, uint16_t frames);
+
+void IIR_Init(struct iir_t *filter, uint8_t channels, uint8_t stride, uint8_t shift);
+void IIR_Process(struct iir_t *filter, int16_t *block, uint16_t frames);
@@ -28,6 +28,10 @@
 //    CS_M:P6.1
 //    SDO (left): P6.5  (MISO AG)
 //    SDO (right):P6.5  (MISO M)
+//    INT1:P6.6
+//  Telemetry (XDS110 backchannel UART):
+//    TX:  P1.3
+//    RX:  P1.2
 // *****************************************************************************
 // standard includes
 #include "msp.h"
@@ -38,86 +42,170 @@
 #include "../inc/Clock.h"
 #include "../inc/CortexM.h"
 #include "../inc/SSD1306.h"
+#include "SSD1306_ext.h"
 // local/custom includes
 #include "LSM9DS1.h"
 #include "piezo_buzzer.h"
+#include "ring_buffer.h"
+#include "scheduler.h"
+#include "power.h"
+#include "fusion.h"
+#include "filter.h"
+#include "flash_store.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "field.h"
 
 
 #define CR   0x0D   // carriage return code
 
-// globally accessable and redefineable variables
-volatile int16_t x, y, z;
-volatile bool wasInterrupt = false;
+#define SAMPLE_WATERMARK   1    // FIFO level that raises INT1, one sample per interrupt at 14.9Hz
+#define SAMPLE_QUEUE_SIZE  32   // samples PORT6_IRQHandler can get ahead of the main loop, power of two
+#define EVENT_QUEUE_SIZE   8    // button edges waiting for the main loop, power of two
+#define UI_PERIOD_MS       50   // state machine pass, button latency. each state redraws at its own rate
+#define IMU_PERIOD_MS      10   // sample ring drain and orientation updates, collects about 1 sample at 119Hz
+#define DISPLAY_IIR_SHIFT  2    // smoothing of the decimated display stream, alpha = 1/4
+#define CAL_REST_MS        2000 // gyro/accel bias averaging, unit held still
+#define CAL_MAG_MS         20000// magnetometer min/max collection, unit rotated
+#define STATE_VERSION      3    // bump when struct lsm9ds1_state_t changes, older saved records are then ignored
+#define POWER_PERIOD_MS    1000 // current budget report window
+#define TELEMETRY_FORMAT   TELEMETRY_BINARY // TELEMETRY_ASCII for a plain terminal
+#define PROFILE_ROWS       7    // scopes per profiler page, under the title
+#define PROFILE_ENTRIES    (PROFILE_SCOPES + 1)    // every scope, then the telemetry drop count
+#define PROFILE_PAGE_MS    2000 // profiler page flip time
+#define SCREEN_FIELDS      7    // most changing values on one screen, the profiler's rows
+#define SFIX1_CHARS        6    // " 999.9"
+#define IDLE_PERIOD_MS     1000 // how often the idle check runs
+#define IDLE_MS            60000// no button press and the sensor still this long and the unit goes to sleep
+#define STILL_MG           63   // every accel axis within this of where it settled counts as still
+#define STILL_MS           10000// and it has to stay that way this long
+#define WAKE_MG            125  // high passed change on any axis that wakes the unit
+#define WAKE_DURATION      1    // 10Hz samples it has to last, knocks on the table don't count
 
-/**
- * Display x,y, and z starting on the second line
- * @param {int16_t} x axis*10 (-9999 to 9999)
- * @param {int16_t} y axis*10 (-9999 to 9999)
- * @param {int16_t} z axis*10 (-9999 to 9999)
- * @returns void
- */
-void displayData(int16_t x, int16_t y, int16_t z, enum ss_t device){
-    SSD1306_SetCursor(0,2);
-    SSD1306_OutString("X Axis: ");
-    SSD1306_OutSFix1(x);
-    // if device = a, display G, if device = g, display dps, if device = m, display mGs
-    if (device == A) {
-        SSD1306_OutString("G");
-    } else if (device == G) {
-        SSD1306_OutString("dps");
-    } else if (device == M) {
-        SSD1306_OutString("mGs");
-    } else {
-        SSD1306_OutString(" ");
-    }
-    SSD1306_OutChar(CR);
-    SSD1306_OutChar(CR);
-    SSD1306_OutString("Y Axis: ");
-    SSD1306_OutSFix1(y);
+// things the ISRs tell the main loop about, other than samples
+enum event_t {EVENT_BUTTON};
+
+RING_DEFINE(sampleRing, struct imu_sample_t, SAMPLE_QUEUE_SIZE)
+RING_DEFINE(eventRing, uint8_t, EVENT_QUEUE_SIZE)
+
+// globally accessable and redefineable variables, only the main loop touches these
+int32_t x, y, z;
+
+enum states {ACCELEROMETER, GYROSCOPE, MAGNETOMETER, THERMOMETER, ORIENTATION, CALIBRATION, PROFILER};  // order of the PROFILE_STATE scopes
+enum states state = ACCELEROMETER;      // start state
+enum states prevState = GYROSCOPE;      // used to know when the state has changed.
+struct imu_sample_t latest;             // newest filtered sample for the display, held over passes with nothing new
+// calibration progress, imuTask feeds the collector while calPhase says so
+enum calPhases {CAL_IDLE, CAL_REST, CAL_MAG, CAL_DONE};
+volatile enum calPhases calPhase = CAL_IDLE;
+struct lsm9ds1_collector_t calCollector;
+struct lsm9ds1_cal_t calOld, calNew;    // what was there before, what is being built
+uint32_t calStart;                      // start of the current phase, ms
+struct boxcar_t displayDecimator;       // full AG rate down to about the UI rate
+struct iir_t displaySmoother;
+struct power_report_t powerReport;      // last 1s current budget, shown on the thermometer screen
+struct lsm9ds1_bus_report_t busReport;  // the sensor's share of the bus over the same window
+struct field_t fields[SCREEN_FIELDS];   // the current screen's values, placed on state entry
+uint32_t lastPress;                     // Scheduler_Millis() of the last button press, for the idle check
+struct ag_value_t stillReference;       // where the unit settled, see stillUpdate()
+uint32_t stillSince;                    // Scheduler_Millis() it settled at
+volatile bool asleep = false;           // in sleepUntilMotion(), INT1 is the wake-on-motion interrupt
+bool fusionRunning = false;             // the current state keeps the gyro up, set by enterState()
+bool sleepPending = false;              // set by idleTask(), the main loop sleeps once nothing is left to do
+
+// played once the sensor is up, in the background while the first frames are drawn
+const struct note_t startupChime[] = {{MC, 80}, {ME, 80}, {HG, 120}};
+
+// ISR to main loop handoff. PORT6_IRQHandler puts samples, PORT1_IRQHandler puts button events
+struct sampleRing_t samples;
+struct eventRing_t events;
+
+// unit suffix for each device. if device = a, display G, if device = g, display dps, if device = m, display mGs
+char *unitString(enum ss_t device){
     if (device == A) {
-        SSD1306_OutString("G");
+        return "G";
     } else if (device == G) {
-        SSD1306_OutString("dps");
+        return "dps";
     } else if (device == M) {
-        SSD1306_OutString("mGs");
-    } else {
-        SSD1306_OutString(" ");
+        return "mGs";
     }
-    SSD1306_OutChar(CR);
-    SSD1306_OutChar(CR);
-    SSD1306_OutString("Z Axis: ");
-    SSD1306_OutSFix1(z);
-    if (device == A) {
-        SSD1306_OutString("G");
-    } else if (device == G) {
-        SSD1306_OutString("dps");
-    } else if (device == M) {
-        SSD1306_OutString("mGs");
-    } else {
-        SSD1306_OutString(" ");
+    return " ";
+}
+
+/**
+ * Draw the fixed part of a "label value unit" line on state entry and place field
+ * for the value between them
+ * @param {struct field_t*} field for the SFIX1_CHARS value
+ * @param {uint8_t} row text row, 0-7
+ * @param {char*} label drawn from the first column
+ * @param {char*} unit drawn after the value
+ * @returns void
+ */
+void displayLabel(struct field_t *field, uint8_t row, char *label, char *unit){
+    uint8_t column = 0;
+
+    while (label[column]) {
+        column++;
     }
+    SSD1306_BufSetCursor(0, row);
+    SSD1306_BufOutString(label);
+    SSD1306_BufSetCursor(column + SFIX1_CHARS, row);
+    SSD1306_BufOutString(unit);
+    Field_Init(field, column, row);
+}
+
+/**
+ * Draw the axis labels and units on state entry, the values go in with displayData()
+ * @param {enum ss_t} device whose unit to show
+ * @returns void
+ */
+void displayLabels(enum ss_t device){
+    displayLabel(&fields[0], 2, "X Axis: ", unitString(device));
+    displayLabel(&fields[1], 4, "Y Axis: ", unitString(device));
+    displayLabel(&fields[2], 6, "Z Axis: ", unitString(device));
+}
+
+/**
+ * Update x,y, and z in the OLED buffer. Only the characters that changed are drawn,
+ * and nothing is sent to the display until the frame is swapped in main
+ * @param {int32_t} x axis*10 (-9999 to 9999)
+ * @param {int32_t} y axis*10 (-9999 to 9999)
+ * @param {int32_t} z axis*10 (-9999 to 9999)
+ * @returns void
+ */
+void displayData(int32_t x, int32_t y, int32_t z){
+    Field_SetSFix1(&fields[0], x);
+    Field_SetSFix1(&fields[1], y);
+    Field_SetSFix1(&fields[2], z);
 }
 
-void getAccelData(){
-    x = LSM9DS1_XA();
-    y = LSM9DS1_YA();
-    z = LSM9DS1_ZA();
+// the get*Data functions leave x, y and z ready for displayData(), in tenths of the unit shown
+void getAccelData(const struct imu_sample_t *sample){
+    struct ag_value_t value;
+    LSM9DS1_ConvertAG(&sample->ag, &value);
+    x = LSM9DS1_Q16ToFixed(value.ax, 10);   // G with 1 decimal place
+    y = LSM9DS1_Q16ToFixed(value.ay, 10);
+    z = LSM9DS1_Q16ToFixed(value.az, 10);
 }
 
-void getGyroData(){
-    x = LSM9DS1_XG();
-    y = LSM9DS1_YG();
-    z = LSM9DS1_ZG();
+void getGyroData(const struct imu_sample_t *sample){
+    struct ag_value_t value;
+    LSM9DS1_ConvertAG(&sample->ag, &value);
+    x = LSM9DS1_Q16ToFixed(value.gx, 10);   // dps with 1 decimal place
+    y = LSM9DS1_Q16ToFixed(value.gy, 10);
+    z = LSM9DS1_Q16ToFixed(value.gz, 10);
 }
 
-void getMagData(){
-    x = LSM9DS1_XM();
-    y = LSM9DS1_YM();
-    z = LSM9DS1_ZM();
+void getMagData(const struct imu_sample_t *sample){
+    struct m_value_t value;
+    LSM9DS1_ConvertM(&sample->m, &value);
+    x = LSM9DS1_Q16ToFixed(value.mx, 10000);    // gauss to mGauss with 1 decimal place
+    y = LSM9DS1_Q16ToFixed(value.my, 10000);
+    z = LSM9DS1_Q16ToFixed(value.mz, 10000);
 }
 
-void getTempData(){
-    x = LSM9DS1_TMP();
+void getTempData(const struct imu_sample_t *sample){
+    x = LSM9DS1_Q16ToFixed(LSM9DS1_ScaleTMP(sample->ag.temp), 10);  // C with 1 decimal place
 }
 
 void PBInt_Init(void){
@@ -136,14 +224,486 @@ void PBInt_Init(void){
 }
 
 void PORT1_IRQHandler(void){
-    wasInterrupt = true;   // relay interrupt
+    uint8_t event = EVENT_BUTTON;
+    eventRing_Put(&events, &event);  // relay interrupt, every press is kept until main gets to it
     P1IFG &= 0x00;      // clear interrupt flags
 }
 
-// main
+// INT1_A/G, the FIFO reached SAMPLE_WATERMARK. this is the only place the sensor is read once
+// main is running, so the SPI bus is never shared between the ISR and the main loop
+void PORT6_IRQHandler(void){
+    static struct ag_sample_t batch[LSM9DS1_FIFO_DEPTH];   // static, too big for the 512 byte stack
+    struct imu_sample_t sample;
+    uint32_t now, rate, periodUs;
+    uint8_t count, i;
+
+    P6IFG &= ~BIT6;     // clear before draining so a new edge isn't lost
+    if (asleep) {
+        asleep = false; // motion, sleepUntilMotion() puts the sensor back
+        return;
+    }
+    rate = LSM9DS1_SampleRate();
+    periodUs = (rate > 0) ? (1000000000 / rate) : 0;
+    do {
+        count = LSM9DS1_ReadFIFO(batch, LSM9DS1_FIFO_DEPTH);
+        now = Scheduler_Micros();
+        LSM9DS1_ReadMBurst(&sample.m);  // M has no FIFO, its newest reading goes with the batch
+        for (i = 0; i < count; i++) {
+            sample.ag = batch[i];
+            sample.time = now - (uint32_t)(count - 1 - i) * periodUs;  // the last slot is the newest
+            sampleRing_Put(&samples, &sample);  // dropped (and counted) if main has fallen that far behind
+        }
+    } while (LSM9DS1_Int1Active() && (count > 0));  // FTH is a level, only a fresh edge re-enters
+}
+
+/**
+ * Stillness check on the full rate stream, the only one there is: LSM9DS1_DevInit()
+ * keeps the sensor's inactivity detector off, as it would drop the AG rate to 10Hz
+ * and sleep the gyro while acquisition assumes LSM9DS1_SampleRate(). Any accel axis more than
+ * STILL_MG from where the unit settled starts the still time again from there
+ * @param {const struct ag_value_t*} ag the converted sample
+ * @returns void
+ */
+void stillUpdate(const struct ag_value_t *ag){
+    const q16_t *axis = &ag->ax;
+    const q16_t *reference = &stillReference.ax;
+    q16_t d;
+    uint8_t i;
+
+    for (i = 0; i < 3; i++) {
+        d = axis[i] - reference[i];
+        if ((d > STILL_MG * Q16_ONE / 1000) || (d < -(STILL_MG * Q16_ONE / 1000))) {
+            stillReference = *ag;
+            stillSince = Scheduler_Millis();
+            return;
+        }
+    }
+}
+
+/**
+ * Drains the sample ring into a block. Full rate consumers (the orientation filter,
+ * telemetry) see every sample first, then the block is decimated and smoothed in place
+ * and the newest result is kept for the display. The filter only runs in states that
+ * keep the gyro up, it would integrate zeros in the others
+ * @returns void
+ */
+void imuTask(void){
+    static struct imu_sample_t block[SAMPLE_QUEUE_SIZE];  // static, too big for the 512 byte stack
+    struct ag_value_t ag;
+    struct m_value_t m;
+    uint16_t count = 0, i;
+
+    while ((count < SAMPLE_QUEUE_SIZE) && sampleRing_Get(&samples, &block[count])) {
+        count++;
+    }
+    // full rate stream
+    for (i = 0; i < count; i++) {
+        LSM9DS1_ConvertAG(&block[i].ag, &ag);
+        LSM9DS1_ConvertM(&block[i].m, &m);
+        if (fusionRunning) {
+            Fusion_Update(&ag, &m);
+        }
+        stillUpdate(&ag);
+        if (calPhase == CAL_REST) {
+            LSM9DS1_CalAddRest(&calCollector, &block[i].ag);
+        } else if (calPhase == CAL_MAG) {
+            LSM9DS1_CalAddMag(&calCollector, &block[i].m);
+        }
+    }
+    Telemetry_Send(block, count);
+    // display stream
+    count = Boxcar_Process(&displayDecimator, (int16_t *)block, count);
+    IIR_Process(&displaySmoother, (int16_t *)block, count);
+    if (count > 0) {
+        latest = block[count - 1];
+    }
+}
+
+/**
+ * Write an unsigned number right aligned in 7 characters, no terminator
+ * @param {char*} out where the 7 characters go
+ * @param {uint32_t} n 0 to 9999999, larger is written as 9999999
+ * @returns void
+ */
+void formatCount(char *out, uint32_t n){
+    uint8_t i;
+
+    if (n > 9999999) {
+        n = 9999999;
+    }
+    for (i = 7; i > 0; i--) {
+        out[i - 1] = ((n > 0) || (i == 7)) ? (char)('0' + n % 10) : ' ';
+        n /= 10;
+    }
+}
+
+/**
+ * One profiler row, the scope name then its average and worst time in us
+ * @param {char*} row 22 bytes for the text
+ * @param {enum profile_scope_t} scope to show
+ * @returns void
+ */
+void formatProfile(char *row, enum profile_scope_t scope){
+    struct profile_stat_t stat;
+    const char *name = Profile_Name(scope);
+    uint8_t i;
+
+    Profile_Get(scope, &stat);
+    for (i = 0; i < 7; i++) {
+        row[i] = *name ? *name++ : ' ';
+    }
+    formatCount(&row[7], (stat.count > 0) ? Profile_CyclesToUs((uint32_t)(stat.totalCycles / stat.count)) : 0);
+    formatCount(&row[14], Profile_CyclesToUs(stat.maxCycles));
+    row[21] = 0;
+}
+
+/**
+ * The profiler's last row, the samples telemetry has dropped since power up in
+ * the avg column
+ * @param {char*} row 22 bytes for the text
+ * @returns void
+ */
+void formatDropped(char *row){
+    const char *name = "dropped";
+    uint8_t i;
+
+    for (i = 0; i < 7; i++) {
+        row[i] = name[i];
+        row[14 + i] = ' ';
+    }
+    formatCount(&row[7], Telemetry_Dropped());
+    row[21] = 0;
+}
+
+/**
+ * Save the sensor's bus speed and calibration to flash so the next power up
+ * starts with them. The configuration isn't saved, stateTable sets it on entry
+ * @returns {bool} false if the flash couldn't be written
+ */
+bool saveSensorState(void){
+    struct lsm9ds1_state_t sensorState;
+    LSM9DS1_GetState(&sensorState);
+    return FlashStore_Save(&sensorState, sizeof(sensorState), STATE_VERSION);
+}
+
+// per screen sensor rates and ranges. The gyro is switched off (accel only mode) where it isn't
+// needed, what else a screen doesn't show is powered down through stateTable's awake parts.
+// The accel always runs, its FIFO slots pace the whole pipeline (and carry the temperature)
+const struct lsm9ds1_config_t SENSOR_ACCEL_ONLY = {
+    ODR_G_OFF,   FS_G_245,  0,
+    ODR_XL_50,   FS_XL_2G,  LSM9DS1_XL_BW_AUTO,
+    ODR_M_20,    FS_M_4,    OM_M_LOW_POWER,
+    MD_M_CONTINUOUS
+};
+const struct lsm9ds1_config_t SENSOR_GYRO = {
+    ODR_G_59_5,  FS_G_245,  0,
+    ODR_XL_50,   FS_XL_2G,  LSM9DS1_XL_BW_AUTO,     // the accel follows the gyro's ODR
+    ODR_M_20,    FS_M_4,    OM_M_LOW_POWER,
+    MD_M_CONTINUOUS
+};
+const struct lsm9ds1_config_t SENSOR_MAG = {
+    ODR_G_OFF,   FS_G_245,  0,
+    ODR_XL_50,   FS_XL_2G,  LSM9DS1_XL_BW_AUTO,     // mag is read with every FIFO drain, keep up with its 20Hz
+    ODR_M_20,    FS_M_4,    OM_M_ULTRA_HIGH,
+    MD_M_CONTINUOUS
+};
+const struct lsm9ds1_config_t SENSOR_TEMP = {
+    ODR_G_OFF,   FS_G_245,  0,
+    ODR_XL_10,   FS_XL_2G,  LSM9DS1_XL_BW_AUTO,
+    ODR_M_20,    FS_M_4,    OM_M_LOW_POWER,
+    MD_M_CONTINUOUS
+};
+const struct lsm9ds1_config_t SENSOR_ALL = {     // orientation and calibration need all three
+    ODR_G_119,   FS_G_245,  0,
+    ODR_XL_119,  FS_XL_2G,  LSM9DS1_XL_BW_AUTO,
+    ODR_M_40,    FS_M_4,    OM_M_ULTRA_HIGH,
+    MD_M_CONTINUOUS
+};
+
+// one screen of the state machine. The axis screens only need sample and device, the rest
+// draw themselves through enter and update
+struct state_t {
+    char *title;
+    uint16_t refreshMs;                         // how often the values are redrawn, a multiple of UI_PERIOD_MS
+    const struct lsm9ds1_config_t *sensor;      // set up on entry
+    void (*sample)(const struct imu_sample_t *sample);  // axis screens: leaves x, y and z for displayData()
+    enum ss_t device;                           // axis screens: whose unit to show
+    uint8_t awake;                              // LSM9DS1_GYRO/ACCEL/MAG parts kept up, the rest are powered down
+    void (*enter)(void);                        // draws the rest of the fixed part after the title, 0 if none
+    void (*update)(void);                       // one refresh, 0 for the axis screens
+    void (*leave)(void);                        // run on the button before moving on, 0 if nothing to do
+    enum states next;                           // where the button goes
+};
+
+void thermometerEnter(void){
+    displayLabel(&fields[0], 2, "Temperature: ", "");
+    displayLabel(&fields[3], 4, "Sensor bus: ", "%");
+    displayLabel(&fields[1], 5, "CPU awake: ", "%");
+    displayLabel(&fields[2], 7, "MCU est: ", "mA");
+}
+
+void thermometerUpdate(void){
+    getTempData(&latest);
+    Field_SetSFix1(&fields[0], x);    // already in C with 1 decimal place
+    Field_SetSFix1(&fields[1], powerReport.awakePermille);    // permille is % with 1 decimal place
+    Field_SetSFix1(&fields[2], powerReport.averageUa / 100);  // uA to mA with 1 decimal place
+    Field_SetSFix1(&fields[3], busReport.busyPermille);
+}
+
+void orientationEnter(void){
+    displayLabel(&fields[0], 2, "Roll:  ", "deg");
+    displayLabel(&fields[1], 3, "Pitch: ", "deg");
+    displayLabel(&fields[2], 4, "Yaw:   ", "deg");
+    displayLabel(&fields[3], 7, "Fusion: ", "%");
+}
+
+void orientationUpdate(void){
+    float roll, pitch, yaw;
+    struct fusion_budget_t budget;
+
+    Fusion_GetEuler(&roll, &pitch, &yaw);
+    Field_SetSFix1(&fields[0], (int32_t)(roll * 10.0f));    // degrees with 1 decimal place
+    Field_SetSFix1(&fields[1], (int32_t)(pitch * 10.0f));
+    Field_SetSFix1(&fields[2], (int32_t)(yaw * 10.0f));
+    Fusion_GetBudget(&budget);
+    Field_SetSFix1(&fields[3], (int32_t)(((uint64_t)budget.maxCycles * 1000) / budget.budgetCycles));   // worst update as % of a sample period
+}
+
+void calibrationEnter(void){
+    SSD1306_BufSetCursor(0,2);
+    SSD1306_BufOutString("Hold still");
+    LSM9DS1_GetCalibration(&calOld);
+    calNew = calOld;
+    LSM9DS1_CalBegin(&calCollector);
+    calStart = Scheduler_Millis();
+    calPhase = CAL_REST;
+}
+
+void calibrationUpdate(void){
+    uint8_t i;
+
+    if ((calPhase == CAL_REST) && ((Scheduler_Millis() - calStart) >= CAL_REST_MS)) {
+        calPhase = CAL_IDLE;
+        LSM9DS1_CalFinishRest(&calCollector, &calNew);
+        LSM9DS1_CalBeginMag(&calCollector);
+        calStart = Scheduler_Millis();
+        calPhase = CAL_MAG;
+        SSD1306_BufSetCursor(0,2);
+        SSD1306_BufOutString("Rotate slowly in");
+        SSD1306_BufSetCursor(0,3);
+        SSD1306_BufOutString("every direction");
+        play_note(MC);
+    } else if ((calPhase == CAL_MAG) && ((Scheduler_Millis() - calStart) >= CAL_MAG_MS)) {
+        calPhase = CAL_DONE;
+        SSD1306_BufSetCursor(0,2);
+        if (LSM9DS1_CalFinishMag(&calCollector, &calNew)) {
+            LSM9DS1_SetCalibration(&calNew);
+            saveSensorState();
+            SSD1306_BufOutString("Done            ");
+        } else {
+            // the rest phase still counts: keep its gyro and accel biases, put back the old mag offsets (cleared for collection)
+            for (i = 0; i < 3; i++) {
+                calNew.magOffset[i] = calOld.magOffset[i];
+                calNew.magScale[i] = calOld.magScale[i];
+            }
+            LSM9DS1_SetCalibration(&calNew);
+            saveSensorState();
+            SSD1306_BufOutString("Mag failed, turn more");
+        }
+        SSD1306_BufSetCursor(0,3);
+        SSD1306_BufOutString("                ");
+        play_note(HG);
+    }
+}
+
+void calibrationLeave(void){
+    if (calPhase != CAL_DONE) {
+        LSM9DS1_SetCalibration(&calOld);   // cut short, keep what was there
+    }
+    calPhase = CAL_IDLE;
+}
+
+void profilerEnter(void){
+    static char report[TELEMETRY_FRAME_BYTES];  // static, too big for the 512 byte stack
+    uint8_t r;
+
+    SSD1306_BufSetCursor(0,0);
+    SSD1306_BufOutString("Profile    avg    max");  // over the title, the columns need the room
+    for (r = 0; r < PROFILE_ROWS; r++) {
+        Field_Init(&fields[r], 0, r + 1);
+    }
+    Telemetry_SendText(report, Profile_Print(report, sizeof(report)));  // the full stats in cycles
+}
+
+void profilerUpdate(void){
+    char row[FIELD_MAX_CHARS + 1];
+    uint8_t r, first;
+
+    first = ((Scheduler_Millis() / PROFILE_PAGE_MS) % ((PROFILE_ENTRIES + PROFILE_ROWS - 1) / PROFILE_ROWS)) * PROFILE_ROWS;
+    for (r = 0; r < PROFILE_ROWS; r++) {
+        if (first + r < PROFILE_SCOPES) {
+            formatProfile(row, (enum profile_scope_t)(first + r));
+        } else if (first + r < PROFILE_ENTRIES) {
+            formatDropped(row);
+        } else {
+            row[0] = 0;     // blanks the row
+        }
+        Field_SetText(&fields[r], row);
+    }
+}
+
+// indexed by enum states
+const struct state_t stateTable[] = {
+    //  title            refresh  sensor               sample         device  awake                         enter             update             leave             next
+    {"Accelerometer",    100,     &SENSOR_ACCEL_ONLY,  getAccelData,  A,      LSM9DS1_ACCEL,                0,                0,                 0,                GYROSCOPE},
+    {"Gyroscope",        100,     &SENSOR_GYRO,        getGyroData,   G,      LSM9DS1_ACCEL | LSM9DS1_GYRO, 0,                0,                 0,                MAGNETOMETER},
+    {"Magnetometer",     100,     &SENSOR_MAG,         getMagData,    M,      LSM9DS1_ACCEL | LSM9DS1_MAG,  0,                0,                 0,                THERMOMETER},
+    {"Thermometer",      1000,    &SENSOR_TEMP,        0,             AG,     LSM9DS1_ACCEL,                thermometerEnter, thermometerUpdate, 0,                ORIENTATION},
+    {"Orientation",      50,      &SENSOR_ALL,         0,             AG,     LSM9DS1_ALL,                  orientationEnter, orientationUpdate, 0,                CALIBRATION},
+    {"Calibration",      100,     &SENSOR_ALL,         0,             AG,     LSM9DS1_ALL,                  calibrationEnter, calibrationUpdate, calibrationLeave, PROFILER},
+    {"Profile",          500,     &LSM9DS1_PROFILE_LOW_POWER, 0,      AG,     LSM9DS1_ACCEL,                profilerEnter,    profilerUpdate,    0,                ACCELEROMETER},
+};
+
+/**
+ * Entry housekeeping shared by every state: draws the fixed part of the screen, sets the
+ * sensor up for it with only the parts it uses powered, and matches the orientation filter
+ * and display filters to its rates. Woken parts settle in the driver, their first samples never get here
+ * @param {const struct state_t*} desc the state being entered
+ * @returns void
+ */
+void enterState(const struct state_t *desc){
+    SSD1306_ClearBuffer();
+    SSD1306_BufSetCursor(0,0);
+    SSD1306_BufOutString(desc->title);
+    if (desc->sample != 0) {
+        displayLabels(desc->device);
+    }
+    if (desc->enter != 0) {
+        desc->enter();
+    }
+    play_note(HG);
+
+    LSM9DS1_PowerDown(LSM9DS1_ALL & ~desc->awake);
+    LSM9DS1_Configure(desc->sensor);
+    LSM9DS1_PowerUp(desc->awake);
+    fusionRunning = (desc->awake & LSM9DS1_GYRO) != 0;
+    Fusion_SetRate(LSM9DS1_SampleRate() / 1000.0f);
+    Boxcar_Init(&displayDecimator, IMU_CHANNELS, IMU_STRIDE, LSM9DS1_SampleRate() / (1000000 / desc->refreshMs));
+    IIR_Init(&displaySmoother, IMU_CHANNELS, IMU_STRIDE, DISPLAY_IIR_SHIFT);
+}
+
+/**
+ * One pass of the state machine engine, run by the scheduler every UI_PERIOD_MS.
+ * Takes at most one button press, and when the current state is due redraws its
+ * values from the newest sample imuTask kept and swaps the frame out to the display
+ * @returns void
+ */
+void uiTask(void){
+    const struct state_t *desc;
+    bool buttonPressed;         // one queued button event is taken per pass
+    uint8_t event;
+    uint32_t now = Scheduler_Millis();
+    uint32_t start;
+    static uint32_t lastRefresh;
+
+    buttonPressed = eventRing_Get(&events, &event) && (event == EVENT_BUTTON);
+    if (state > PROFILER) {
+        state = ACCELEROMETER;
+    }
+    desc = &stateTable[state];
+
+    start = PROFILE_START();
+    // entry housekeeping
+    if (state != prevState) {
+        prevState = state;  // save state for next time
+        enterState(desc);
+        lastRefresh = now - desc->refreshMs;    // values straight away
+    }
+    // state housekeeping, at the state's own rate
+    if ((now - lastRefresh) >= desc->refreshMs) {
+        lastRefresh = now;
+        if (desc->update != 0) {
+            desc->update();
+        } else {
+            desc->sample(&latest);
+            displayData(x, y, z);
+        }
+        PROFILE_STOP((enum profile_scope_t)(PROFILE_STATE + state), start);
+        SSD1306_SwapBuffers();  // send whatever changed this pass in one DMA frame
+    }
+    // exit housekeeping
+    if (buttonPressed) {
+        lastPress = now;
+        sleepPending = false;   // idleTask() decided before this press
+        if (desc->leave != 0) {
+            desc->leave();
+        }
+        state = desc->next;
+    }
+}
+
+// closes a current budget window and a bus load window for the thermometer screen
+void powerTask(void){
+    Power_Report(&powerReport);
+    LSM9DS1_BusReport(&busReport);
+}
+
+/**
+ * Wake-on-motion: turns the panel off, leaves the sensor watching for motion with
+ * the gyro and mag off, and keeps the MCU in LPM3 until the sensor or the button
+ * wakes it. Then puts everything back and carries on at the current state's rates.
+ * The press that wakes the unit doesn't change the screen. Only called from the
+ * main loop, between Scheduler_Run() passes, with no task due and the buzzer,
+ * telemetry and display DMA all idle, as SMCLK stops in LPM3 and nothing would
+ * finish them. Periodic tasks pick up one period after the wake, with no burst
+ * @returns void
+ */
+void sleepUntilMotion(void){
+    SSD1306_Sleep(true);
+    asleep = true;
+    LSM9DS1_WakeOnMotion(WAKE_MG, WAKE_DURATION);
+    DisableInterrupts();
+    while (asleep && (eventRing_Count(&events) == 0)) {
+        Power_DeepSleep();
+        EnableInterrupts();     // whatever woke it runs here
+        DisableInterrupts();
+    }
+    asleep = false;
+    EnableInterrupts();
+    LSM9DS1_Resume();
+    eventRing_Clear(&events);
+    sampleRing_Clear(&samples);
+    SSD1306_Sleep(false);       // the panel kept the last frame
+    lastPress = Scheduler_Millis();
+    stillSince = lastPress;
+}
+
+/**
+ * Asks for wake-on-motion once nobody has pressed the button for IDLE_MS and the unit
+ * has been still for STILL_MS. It doesn't sleep itself: parking the MCU inside a task
+ * would hold up every task behind it and leave the buzzer queue, a telemetry frame or a
+ * display frame stuck half done. The main loop drains those first, see main()
+ * @returns void
+ */
+void idleTask(void){
+    if ((Scheduler_Millis() - lastPress) < IDLE_MS) {
+        return;
+    }
+    if ((calPhase == CAL_REST) || (calPhase == CAL_MAG)) {
+        return;
+    }
+    if ((Scheduler_Millis() - stillSince) >= STILL_MS) {
+        sleepPending = true;
+    }
+}
+
+// main, bench_main.c has its own when BENCHMARK is defined
+#ifndef BENCHMARK
 void main(void){
 	WDT_A->CTL = WDT_A_CTL_PW | WDT_A_CTL_HOLD;		// stop watchdog timer
 	Clock_Init48MHz();
+	Scheduler_Init();
+	Profile_Init();
 
 	// init PB
 	DisableInterrupts();
@@ -153,108 +713,54 @@ void main(void){
 	SSD1306_Init(SSD1306_SWITCHCAPVCC); // 3.3V power
 	SSD1306_ClearBuffer();
 	SSD1306_DisplayBuffer();
-	Clock_Delay1ms(500);
+	SSD1306_SetDoubleBuffer(true);     // draw the next frame while the last one is sent by DMA
+	Scheduler_Sleep(500);
 
-	// LSM9DS1 init
-	LSM9DS1_Init();
+	// LSM9DS1 init, with the saved bus speed and calibration when there are some. otherwise picks the fastest SPI clock the sensor answers at
+	struct lsm9ds1_state_t sensorState;
+	bool haveState = FlashStore_Load(&sensorState, sizeof(sensorState), STATE_VERSION);
+	if (LSM9DS1_InitFrom(haveState ? &sensorState : 0) == 0) {
+	    SSD1306_BufSetCursor(0,0);
+	    SSD1306_BufOutString("LSM9DS1 not found");
+	    SSD1306_SwapBuffers();
+	    while(1){}  // nothing to show without the sensor
+	}
 
     // init buzzer
     piezo_init();
+    play_sequence(startupChime, sizeof(startupChime) / sizeof(startupChime[0]));
 
-    enum states {ACCELEROMETER, GYROSCOPE, MAGNETOMETER, THERMOMETER} state, prevState;
-    state = ACCELEROMETER;             // start state
-    prevState = GYROSCOPE;  // used to know when the state has changed.
-    bool isNewState;            // true when the state has switched
-
-	// basically copy and paste the following 3 lines for each state
-//	SSD1306_SetCursor(0,0);
-//	SSD1306_OutString("Accelerometer");
-//	displayData(1235, 8735, 3345);
+    // stream through the FIFO and let INT1 say when there is something to read
+    LSM9DS1_FIFOInit(FIFO_CONTINUOUS, SAMPLE_WATERMARK);
+    LSM9DS1_EnableInt1(LSM9DS1_INT1_FTH);
 
+    // each state sets the sensor up for itself on entry, see stateTable
+    Fusion_Init(LSM9DS1_SampleRate() / 1000.0f, FUSION_BETA);
+    Telemetry_Init(TELEMETRY_FORMAT);
+    Scheduler_AddPeriodic(imuTask, IMU_PERIOD_MS);
+    Scheduler_AddPeriodic(uiTask, UI_PERIOD_MS);
+    Scheduler_AddPeriodic(powerTask, POWER_PERIOD_MS);
+    Scheduler_AddPeriodic(idleTask, IDLE_PERIOD_MS);
+    Power_Report(&powerReport);     // open the first window
+    LSM9DS1_BusReport(&busReport);
 
     while(1){
-        isNewState = (state != prevState);
-        prevState = state;  // save state for next time
-
-        switch (state) {
-        case ACCELEROMETER:
-            // entry housekeeping
-            if (isNewState) {
-                SSD1306_ClearBuffer();
-                SSD1306_DisplayBuffer();
-                SSD1306_SetCursor(0,0);
-                SSD1306_OutString("Accelerometer");
-                play_note(HG);
-            }
-            // case housekeeping
-            getAccelData();
-            displayData((x / 100), (y / 100), (z / 100), A);   // turn MG to G with 1 decimal place
-            // exit housekeeping
-            if (wasInterrupt) {
-                wasInterrupt = false;
-                state = GYROSCOPE;
-            }
-            break;
-        case GYROSCOPE:
-            // entry housekeeping
-            if (isNewState) {
-                SSD1306_ClearBuffer();
-                SSD1306_DisplayBuffer();
-                SSD1306_SetCursor(0,0);
-                SSD1306_OutString("Gyroscope");
-                play_note(HG);
-            }
-            // case housekeeping
-            getGyroData();
-            displayData((x / 100), (y / 100), (z / 100), G);   // turn mdp to dps with 1 decimal place
-            // exit housekeeping
-            if (wasInterrupt) {
-                wasInterrupt = false;
-                state = MAGNETOMETER;
-            }
-            break;
-        case MAGNETOMETER:
-            // entry housekeeping
-            if (isNewState) {
-                SSD1306_ClearBuffer();
-                SSD1306_DisplayBuffer();
-                SSD1306_SetCursor(0,0);
-                SSD1306_OutString("Magnetometer");
-                play_note(HG);
-            }
-            // case housekeeping
-            getMagData();
-            displayData((x * 10), (y * 10), (z * 10), M);   // keep in mGuass with 1 decimal place
-            // exit housekeeping
-            if (wasInterrupt) {
-                wasInterrupt = false;
-                state = THERMOMETER;
-            }
-            break;
-        case THERMOMETER:
-            // entry housekeeping
-            if (isNewState) {
-                SSD1306_ClearBuffer();
-                SSD1306_DisplayBuffer();
-                SSD1306_SetCursor(0,0);
-                SSD1306_OutString("Thermometer");
-                play_note(HG);
-            }
-            // case housekeeping
-            x = LSM9DS1_TMP();
-            SSD1306_SetCursor(0,2);
-            SSD1306_OutString("Temperature: ");
-            SSD1306_OutSFix1(x);    // already in C with 1 decimal place
-            // exit housekeeping
-            if (wasInterrupt) {
-                wasInterrupt = false;
-                state = ACCELEROMETER;
+        // LPM0 until a task is due. SysTick wakes it every ms at the latest, and interrupts are
+        // masked around the check so one that fires in between still wakes it up. A sleep
+        // idleTask() asked for waits here until no task is due and the buzzer, telemetry and
+        // display DMA have finished, the interrupts that end them wake LPM0 to check again
+        DisableInterrupts();
+        if (!Scheduler_Due()) {
+            if (sleepPending && !piezo_busy() && !Telemetry_Busy() && !SSD1306_DMABusy()) {
+                sleepPending = false;
+                EnableInterrupts();
+                sleepUntilMotion();
+                continue;
             }
-            break;
-        default:
-            state = ACCELEROMETER;
-            break;
+            Power_Sleep();
         }
-        Clock_Delay1ms(100);    // "operate" at ~10Hz
+        EnableInterrupts();
+        Scheduler_Run();
     }
 }
+#endif
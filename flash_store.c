@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "msp.h"
+#include "flash_store.h"
+
+#define STORE_MAGIC     0x5354      // "ST"
+#define SLOT_SIZE       (sizeof(struct header_t) + FLASH_STORE_MAX_DATA)   // 256 bytes, 16 per sector
+#define SLOTS           (FLASH_STORE_SECTOR_SIZE / SLOT_SIZE)
+#define ERASE_TRIES     5           // erase pulses before giving up on a sector
+
+// bank 1 sector numbers for FLCTL->BANK1_MAIN_WEPROT, bank 1 starts at 0x20000
+#define SECTOR_BIT(address) (1UL << (((address) - 0x00020000) / FLASH_STORE_SECTOR_SIZE))
+
+struct header_t {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t length;
+    uint32_t sequence;      // bigger is newer
+    uint16_t crc;           // over data[0..length-1]
+    uint16_t reserved;
+    uint32_t reserved2;     // pads the header to one 128 bit flash word
+};
+
+static uint32_t sectorAddress(uint8_t sector){
+    return FLASH_STORE_BASE + (uint32_t)sector * FLASH_STORE_SECTOR_SIZE;
+}
+
+// CRC-16/CCITT, bitwise. a record is a few dozen bytes and only checked at boot and on save
+static uint16_t crc16(const uint8_t *data, uint16_t length){
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+    uint8_t bit;
+
+    for (i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static bool slotValid(const struct header_t *header, uint8_t version){
+    return (header->magic == STORE_MAGIC) && (header->version == version) &&
+           (header->length <= FLASH_STORE_MAX_DATA) &&
+           (header->crc == crc16((const uint8_t *)(header + 1), header->length));
+}
+
+static bool slotBlank(uint32_t address){
+    const uint32_t *word = (const uint32_t *)address;
+    uint16_t i;
+    for (i = 0; i < SLOT_SIZE / 4; i++) {
+        if (word[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// finds the newest valid record of this version, false if there is none
+static bool findNewest(uint8_t version, const struct header_t **newest, uint8_t *sector, uint8_t *slot){
+    const struct header_t *header;
+    uint8_t s, i;
+    bool found = false;
+
+    for (s = 0; s < 2; s++) {
+        for (i = 0; i < SLOTS; i++) {
+            header = (const struct header_t *)(sectorAddress(s) + (uint32_t)i * SLOT_SIZE);
+            if (slotValid(header, version) && (!found || (header->sequence > (*newest)->sequence))) {
+                *newest = header;
+                *sector = s;
+                *slot = i;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+// Erases one sector and checks it reads back blank, with a few retries. The sector is only
+// unprotected for as long as it takes
+static bool eraseSector(uint32_t address){
+    uint8_t tries, i;
+    bool blank = false;
+
+    FLCTL->BANK1_MAIN_WEPROT &= ~SECTOR_BIT(address);
+    for (tries = 0; (tries < ERASE_TRIES) && !blank; tries++) {
+        FLCTL->ERASE_CTLSTAT = FLCTL_ERASE_CTLSTAT_CLR_STAT;   // sector mode, main memory
+        FLCTL->ERASE_SECTADDR = address;
+        FLCTL->ERASE_CTLSTAT |= FLCTL_ERASE_CTLSTAT_START;
+        while ((FLCTL->ERASE_CTLSTAT & FLCTL_ERASE_CTLSTAT_STATUS_MASK) != FLCTL_ERASE_CTLSTAT_STATUS_3) {}
+        blank = true;
+        for (i = 0; (i < SLOTS) && blank; i++) {
+            blank = slotBlank(address + (uint32_t)i * SLOT_SIZE);
+        }
+    }
+    FLCTL->BANK1_MAIN_WEPROT |= SECTOR_BIT(address);
+    return blank;
+}
+
+// Programs words into blank flash, one 32 bit immediate write at a time with pre and post
+// program verify, then compares the result
+static bool program(uint32_t address, const uint32_t *words, uint16_t count){
+    volatile uint32_t *flash = (volatile uint32_t *)address;
+    uint16_t i;
+
+    FLCTL->BANK1_MAIN_WEPROT &= ~SECTOR_BIT(address);
+    FLCTL->CLRIFG = FLCTL_CLRIFG_PRG_ERR;
+    FLCTL->PRG_CTLSTAT = FLCTL_PRG_CTLSTAT_ENABLE | FLCTL_PRG_CTLSTAT_VER_PRE | FLCTL_PRG_CTLSTAT_VER_PST;  // immediate mode
+    for (i = 0; i < count; i++) {
+        flash[i] = words[i];
+        while (FLCTL->PRG_CTLSTAT & FLCTL_PRG_CTLSTAT_STATUS_MASK) {}
+    }
+    FLCTL->PRG_CTLSTAT = 0;
+    FLCTL->BANK1_MAIN_WEPROT |= SECTOR_BIT(address);
+    return ((FLCTL->IFG & FLCTL_IFG_PRG_ERR) == 0) && (memcmp((const void *)address, words, count * 4) == 0);
+}
+
+// copies the newest saved record of this version into data. false (data untouched) if there isn't one,
+// or it was saved with a different length
+bool FlashStore_Load(void *data, uint16_t length, uint8_t version){
+    const struct header_t *newest;
+    uint8_t sector, slot;
+
+    if (!findNewest(version, &newest, &sector, &slot) || (newest->length != length)) {
+        return false;
+    }
+    memcpy(data, newest + 1, length);
+    return true;
+}
+
+// Appends data as the newest record. blocks for the programming time (about 1 ms for a slot, plus
+// an erase of up to ~100 ms when the active sector is full), so call it from the main loop, not an ISR
+bool FlashStore_Save(const void *data, uint16_t length, uint8_t version){
+    static uint32_t image[SLOT_SIZE / 4];   // header + data, word aligned for programming
+    struct header_t *header = (struct header_t *)image;
+    const struct header_t *newest;
+    uint8_t sector = 1, slot = SLOTS - 1;   // as if the last slot of sector 1 was used, so a fresh store starts at sector 0
+    uint32_t sequence = 0;
+    uint32_t address;
+
+    if (length > FLASH_STORE_MAX_DATA) {
+        return false;
+    }
+    if (findNewest(version, &newest, &sector, &slot)) {
+        sequence = newest->sequence + 1;
+    }
+    // next slot after the newest. when the sector is used up (or the next slot holds a half finished
+    // save) move to the other one and erase it: it only has older copies, the newest is never erased
+    slot++;
+    address = sectorAddress(sector) + (uint32_t)slot * SLOT_SIZE;
+    if ((slot >= SLOTS) || !slotBlank(address)) {
+        sector ^= 1;
+        address = sectorAddress(sector);
+        if (!eraseSector(address)) {
+            return false;
+        }
+    }
+
+    memset(image, 0xFF, sizeof(image));
+    header->magic = STORE_MAGIC;
+    header->version = version;
+    header->length = (uint8_t)length;
+    header->sequence = sequence;
+    header->crc = crc16((const uint8_t *)data, length);
+    header->reserved = 0xFFFF;
+    header->reserved2 = 0xFFFFFFFF;
+    memcpy(header + 1, data, length);
+    return program(address, image, (sizeof(struct header_t) + length + 3) / 4);
+}
@@ -0,0 +1,15 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Versioned, CRC checked record store in the last two 4 KB sectors of main flash (bank 1, sectors 30
+// and 31), which msp432p401r.cmd keeps the program out of. Each save appends a new copy of the record
+// to the active sector; when it fills up the other sector is erased and takes over, so every erase
+// is spread over a sector's worth of saves and the two sectors wear evenly. The newest valid
+// copy wins, so a save cut short by a reset just leaves the previous one in place
+
+#define FLASH_STORE_BASE        0x0003E000
+#define FLASH_STORE_SECTOR_SIZE 0x1000
+#define FLASH_STORE_MAX_DATA    240     // largest record, bytes
+
+bool FlashStore_Load(void *data, uint16_t length, uint8_t version);
+bool FlashStore_Save(const void *data, uint16_t length, uint8_t version);
@@ -0,0 +1,16 @@
+#include <stdint.h>
+#include "format.h"
+
+char *Format_PutDecimal(char *out, uint32_t value){
+    char digits[10];
+    uint8_t n = 0;
+
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
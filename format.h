@@ -0,0 +1,7 @@
+#include <stdint.h>
+
+// Text output helpers shared by the reports that build lines straight into a buffer (telemetry's
+// ASCII stream, Profile_Print()). No terminator is written, each returns the new end of the text.
+
+// unsigned decimal, no padding, at most 10 characters
+char *Format_PutDecimal(char *out, uint32_t value);
@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <math.h>
+#include "msp.h"
+#include "fusion.h"
+#include "../inc/Clock.h"
+
+#define DEG_TO_RAD  0.0174532925f
+#define RAD_TO_DEG  57.2957795f
+#define Q16_TO_F    (1.0f / 65536.0f)
+
+static float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;    // sensor to earth frame
+static float dt;                                            // s per sample
+static float beta;
+static struct fusion_budget_t budget;
+
+// resets the orientation to level, facing north, and starts the DWT cycle counter for the budget
+void Fusion_Init(float sampleHz, float gain){
+    q0 = 1.0f;
+    q1 = 0.0f;
+    q2 = 0.0f;
+    q3 = 0.0f;
+    dt = 1.0f / sampleHz;
+    beta = gain;
+    budget.lastCycles = 0;
+    budget.maxCycles = 0;
+    budget.budgetCycles = (uint32_t)(Clock_GetFreq() / sampleHz);
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// a new sample rate after LSM9DS1_Configure(), the orientation carries on
+void Fusion_SetRate(float sampleHz){
+    dt = 1.0f / sampleHz;
+    budget.maxCycles = 0;
+    budget.budgetCycles = (uint32_t)(Clock_GetFreq() / sampleHz);
+}
+
+static float invSqrt(float x){
+    return 1.0f / sqrtf(x);     // VSQRT and VDIV on the FPU, 14 cycles each
+}
+
+// one filter step from a converted AG sample and the newest mag reading. A zero mag vector
+// (mag off, or not read yet) falls back to the accel/gyro only step, so yaw then drifts freely
+void Fusion_Update(const struct ag_value_t *ag, const struct m_value_t *m){
+    float gx, gy, gz, ax, ay, az, mx, my, mz;
+    float recipNorm;
+    float s0, s1, s2, s3;
+    float qDot1, qDot2, qDot3, qDot4;
+    float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+    float _2q0, _2q1, _2q2, _2q3;
+    uint32_t start = DWT->CYCCNT;
+
+    gx = ag->gx * (Q16_TO_F * DEG_TO_RAD);
+    gy = ag->gy * (Q16_TO_F * DEG_TO_RAD);
+    gz = ag->gz * (Q16_TO_F * DEG_TO_RAD);
+    ax = ag->ax * Q16_TO_F;
+    ay = ag->ay * Q16_TO_F;
+    az = ag->az * Q16_TO_F;
+    // the M die's X and Y axes are swapped and flipped against the AG die's, see the datasheet's pin 1 diagram
+    mx = -m->my * Q16_TO_F;
+    my = -m->mx * Q16_TO_F;
+    mz = m->mz * Q16_TO_F;
+
+    // rate of change of the quaternion from the gyro
+    qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    // gradient descent correction, only with a usable accel vector (free fall gives none)
+    if (!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+        recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+        ax *= recipNorm;
+        ay *= recipNorm;
+        az *= recipNorm;
+
+        _2q0 = 2.0f * q0;
+        _2q1 = 2.0f * q1;
+        _2q2 = 2.0f * q2;
+        _2q3 = 2.0f * q3;
+        q0q0 = q0 * q0;
+        q0q1 = q0 * q1;
+        q0q2 = q0 * q2;
+        q0q3 = q0 * q3;
+        q1q1 = q1 * q1;
+        q1q2 = q1 * q2;
+        q1q3 = q1 * q3;
+        q2q2 = q2 * q2;
+        q2q3 = q2 * q3;
+        q3q3 = q3 * q3;
+
+        if ((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
+            // accel/gyro only
+            s0 = 2.0f * _2q0 * q2q2 + _2q2 * ax + 2.0f * _2q0 * q1q1 - _2q1 * ay;
+            s1 = 2.0f * _2q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - 2.0f * _2q1 +
+                 4.0f * _2q1 * q1q1 + 4.0f * _2q1 * q2q2 + 2.0f * _2q1 * az;
+            s2 = 4.0f * q0q0 * q2 + _2q0 * ax + 2.0f * _2q2 * q3q3 - _2q3 * ay - 2.0f * _2q2 +
+                 4.0f * _2q2 * q1q1 + 4.0f * _2q2 * q2q2 + 2.0f * _2q2 * az;
+            s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+        } else {
+            float hx, hy, _2bx, _2bz, _4bx, _4bz;
+            float _2q0mx, _2q0my, _2q0mz, _2q1mx, _2q0q2, _2q2q3;
+            float ex, ey, ez;   // earth field error terms shared by s0-s3
+
+            recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+            mx *= recipNorm;
+            my *= recipNorm;
+            mz *= recipNorm;
+
+            _2q0mx = _2q0 * mx;
+            _2q0my = _2q0 * my;
+            _2q0mz = _2q0 * mz;
+            _2q1mx = _2q1 * mx;
+            _2q0q2 = _2q0 * q2;
+            _2q2q3 = _2q2 * q3;
+
+            // reference direction of the earth's field, horizontal (bx) and vertical (bz)
+            hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+            hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+            _2bx = sqrtf(hx * hx + hy * hy);
+            _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+            _4bx = 2.0f * _2bx;
+            _4bz = 2.0f * _2bz;
+
+            ex = _2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx;
+            ey = _2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my;
+            ez = _2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz;
+
+            s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay) -
+                 _2bz * q2 * ex + (-_2bx * q3 + _2bz * q1) * ey + _2bx * q2 * ez;
+            s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) -
+                 4.0f * q1 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * q3 * ex +
+                 (_2bx * q2 + _2bz * q0) * ey + (_2bx * q3 - _4bz * q1) * ez;
+            s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) -
+                 4.0f * q2 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * ex +
+                 (_2bx * q1 + _2bz * q3) * ey + (_2bx * q0 - _4bz * q2) * ez;
+            s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) +
+                 (-_4bx * q3 + _2bz * q1) * ex + (-_2bx * q0 + _2bz * q2) * ey + _2bx * q1 * ez;
+        }
+
+        // step along the normalised gradient
+        recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+        if (recipNorm < 1e30f) {    // a zero gradient means it is already there
+            qDot1 -= beta * s0 * recipNorm;
+            qDot2 -= beta * s1 * recipNorm;
+            qDot3 -= beta * s2 * recipNorm;
+            qDot4 -= beta * s3 * recipNorm;
+        }
+    }
+
+    // integrate and renormalise
+    q0 += qDot1 * dt;
+    q1 += qDot2 * dt;
+    q2 += qDot3 * dt;
+    q3 += qDot4 * dt;
+    recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q0 *= recipNorm;
+    q1 *= recipNorm;
+    q2 *= recipNorm;
+    q3 *= recipNorm;
+
+    budget.lastCycles = DWT->CYCCNT - start;
+    if (budget.lastCycles > budget.maxCycles) {
+        budget.maxCycles = budget.lastCycles;
+    }
+}
+
+// w, x, y, z
+void Fusion_GetQuaternion(float q[4]){
+    q[0] = q0;
+    q[1] = q1;
+    q[2] = q2;
+    q[3] = q3;
+}
+
+// aerospace sequence (yaw, then pitch, then roll) in degrees. only worked out when asked,
+// so the trig isn't paid on every update
+void Fusion_GetEuler(float *roll, float *pitch, float *yaw){
+    float sinp = -2.0f * (q1 * q3 - q0 * q2);
+
+    if (sinp > 1.0f) {
+        sinp = 1.0f;        // rounding past +-90 degrees
+    } else if (sinp < -1.0f) {
+        sinp = -1.0f;
+    }
+    *roll = atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2) * RAD_TO_DEG;
+    *pitch = asinf(sinp) * RAD_TO_DEG;
+    *yaw = atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3) * RAD_TO_DEG;
+}
+
+void Fusion_GetBudget(struct fusion_budget_t *out){
+    *out = budget;
+}
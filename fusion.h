@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include "LSM9DS1.h"
+
+// Madgwick MARG orientation filter on the M4F's FPU. Feed it every AG sample in order with
+// Fusion_Update(), it keeps a unit quaternion from the sensor frame to the earth frame
+
+#define FUSION_BETA 0.1f    // gradient step weight, higher trusts accel/mag more over the gyro
+
+// cycle counts from the DWT, to check an update fits between two samples
+struct fusion_budget_t {
+    uint32_t lastCycles;    // the most recent Fusion_Update()
+    uint32_t maxCycles;     // the worst since Fusion_Init() or Fusion_SetRate()
+    uint32_t budgetCycles;  // CPU cycles per sample at the rate given to Fusion_Init() or Fusion_SetRate()
+};
+
+void Fusion_Init(float sampleHz, float beta);
+void Fusion_SetRate(float sampleHz);
+void Fusion_Update(const struct ag_value_t *ag, const struct m_value_t *m);
+void Fusion_GetQuaternion(float q[4]);
+void Fusion_GetEuler(float *roll, float *pitch, float *yaw);
+void Fusion_GetBudget(struct fusion_budget_t *budget);
@@ -44,7 +44,8 @@
 
 MEMORY
 {
-    MAIN       (RX) : origin = 0x00000000, length = 0x00040000
+    /* the last two 4 KB sectors (0x3E000-0x3FFFF) hold flash_store.c's records */
+    MAIN       (RX) : origin = 0x00000000, length = 0x0003E000
     INFO       (RX) : origin = 0x00200000, length = 0x00004000
 #ifdef  __TI_COMPILER_VERSION__
 #if     __TI_COMPILER_VERSION__ >= 15009000
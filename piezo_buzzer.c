@@ -2,6 +2,9 @@
 #include <math.h>
 #include "msp.h"
 #include "piezo_buzzer.h"
+#include "scheduler.h"
+#include "ring_buffer.h"
+#include "profile.h"
 
 void piezo_init(void){
     // sets SMCLK and stop mode
@@ -17,17 +20,80 @@ void piezo_init(void){
     P2SEL0 |=  BIT4;
 }
 
-void play_note(volatile uint16_t note){
+// notes waiting to be played, oldest first. both ends are only touched from the main loop
+// (play_sequence() and the note_next() task), the ring just keeps the bookkeeping simple
+RING_DEFINE(noteRing, struct note_t, NOTE_QUEUE_SIZE)
+static struct noteRing_t notes;
+static int8_t nextTask = -1;    // pending note_next(), -1 when idle
+
+static void tone(uint16_t period){
+    if (period == REST) {
+        // set in stop mode
+        TA0CTL &= ~0x0030;
+        return;
+    }
     // sets CCR0 to note period
-    TA0CCR0 = note;
+    TA0CCR0 = period;
     // sets CCR1 to half of the note period, to make a square wave
-    TA0CCR1 = (note / 2);
+    TA0CCR1 = (period / 2);
     // set in up mode
     TA0CTL |= 0x0010;
-    // delay so its a short beep
-    Clock_Delay1ms(50);
-    // set in stop mode
-    TA0CTL &= ~0x0030;
-    // instructions suggest a 50ms delay
-    Clock_Delay1ms(50);
+}
+
+// starts the next queued note and schedules itself for when it ends. stops when the queue runs dry
+static void note_next(void){
+    struct note_t note;
+
+    nextTask = -1;
+    if (!noteRing_Get(&notes, &note)) {
+        tone(REST);
+        return;
+    }
+    tone(note.period);
+    nextTask = Scheduler_AddOneShot(note_next, note.ms);
+    if (nextTask < 0) {
+        piezo_stop();   // no free slot, better silent than stuck on
+    }
+}
+
+// queues count notes behind whatever is already playing and returns right away.
+// returns false (and queues none of them) if they don't all fit
+bool play_sequence(const struct note_t *sequence, uint8_t count){
+    uint8_t i;
+
+    if ((NOTE_QUEUE_SIZE - noteRing_Count(&notes)) < count) {
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        noteRing_Put(&notes, &sequence[i]);
+    }
+    if (nextTask < 0) {
+        note_next();    // idle, start now
+    }
+    return true;
+}
+
+// a short beep followed by a short gap, so back to back beeps stay distinct
+void play_note(volatile uint16_t note){
+    struct note_t beep[2];
+    uint32_t start = PROFILE_START();
+
+    beep[0].period = note;
+    beep[0].ms = NOTE_MS;
+    beep[1].period = REST;
+    beep[1].ms = NOTE_MS;   // instructions suggest a 50ms delay
+    play_sequence(beep, 2);
+    PROFILE_STOP(PROFILE_PLAY_NOTE, start);
+}
+
+bool piezo_busy(void){
+    return nextTask >= 0;
+}
+
+// silences the buzzer and drops everything queued
+void piezo_stop(void){
+    Scheduler_Cancel(nextTask);
+    nextTask = -1;
+    noteRing_Clear(&notes);
+    tone(REST);
 }
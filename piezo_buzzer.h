@@ -1,4 +1,8 @@
 #include <stdint.h>
+#include <stdbool.h>
+
+#define NOTE_MS 50          // how long play_note() sounds
+#define NOTE_QUEUE_SIZE 16  // notes play_sequence() can hold, power of two
 
 #define LLF  15306
 #define LLFS 14446
@@ -27,6 +31,16 @@
 #define MF  3826
 #define MFS 3610
 #define HG  3408
+#define REST 0      // silence for the note's duration
+
+// one step of a play_sequence(), period is one of the note defines above
+struct note_t {
+    uint16_t period;
+    uint16_t ms;
+};
 
 void piezo_init(void);
-void play_note(volatile uint16_t note);
\ No newline at end of file
+void play_note(volatile uint16_t note);
+bool play_sequence(const struct note_t *sequence, uint8_t count);
+bool piezo_busy(void);
+void piezo_stop(void);
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "msp.h"
+#include "power.h"
+#include "scheduler.h"
+#include "../inc/CortexM.h"
+
+static uint32_t windowStart;    // Scheduler_Micros() when the current report window opened
+static uint32_t asleepUs;       // time spent in Power_Sleep() this window
+static uint16_t deepSleeps;
+
+// LPM0 until the next interrupt: the CPU stops but MCLK and SMCLK keep running, so the DMA, the eUSCIs,
+// Timer_A and SysTick carry on and wake it. Call with interrupts masked (DisableInterrupts()) right after
+// checking there is nothing to do, WFI still wakes on a pending interrupt and the handler runs once they
+// are enabled again. The time asleep goes into the report
+void Power_Sleep(void){
+    uint32_t start;
+
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;     // plain sleep is LPM0
+    start = Scheduler_Micros();
+    WaitForInterrupt();
+    asleepUs += Scheduler_Micros() - start;
+}
+
+// LPM3 until a port interrupt (the button on P1, the sensor on P6). MCLK, SMCLK and HFXT stop, so SysTick,
+// the DMA and every eUSCI stop with them: only call this once the display refresh and any SPI transfer are
+// done. Scheduler_Millis() doesn't advance while in here. Same masking rules as Power_Sleep()
+void Power_DeepSleep(void){
+    // wait for the PCM to be idle, then request LPM3 (LPMR = 0)
+    while(PCM->CTL1&0x00000100){};
+    PCM->CTL0 = (PCM->CTL0&~0xFFFF00F0) |   // clear PCMKEY and LPMR bit fields
+                0x695A0000;                 // write the proper PCM key to unlock write access, LPMR = LPM3
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    WaitForInterrupt();
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;     // back to LPM0 for Power_Sleep()
+    deepSleeps++;
+}
+
+// fills report for the time since the last call and starts a new window
+void Power_Report(struct power_report_t *report){
+    uint32_t now = Scheduler_Micros();
+    uint32_t window = now - windowStart;
+    uint32_t asleep = asleepUs;
+
+    if (asleep > window) {
+        asleep = window;
+    }
+    report->windowUs = window;
+    report->deepSleeps = deepSleeps;
+    if (window == 0) {
+        report->awakePermille = 1000;
+        report->averageUa = POWER_ACTIVE_UA;
+    } else {
+        report->awakePermille = (uint16_t)(((uint64_t)(window - asleep) * 1000) / window);
+        report->averageUa = (uint32_t)(((uint64_t)(window - asleep) * POWER_ACTIVE_UA +
+                                        (uint64_t)asleep * POWER_LPM0_UA) / window);
+    }
+    windowStart = now;
+    asleepUs = 0;
+    deepSleeps = 0;
+}
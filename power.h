@@ -0,0 +1,18 @@
+#include <stdint.h>
+
+// Approximate MSP432P401R supply currents in uA at 48 MHz, LDO, VCORE1 (datasheet typicals).
+// Only used for the estimate in struct power_report_t, adjust them to measurements if you have some
+#define POWER_ACTIVE_UA  4600   // AM_LDO_VCORE1, running from flash
+#define POWER_LPM0_UA    1700   // LPM0_LDO_VCORE1, CPU off with MCLK/SMCLK running
+#define POWER_LPM3_UA    1      // LPM3, only port interrupts running
+
+struct power_report_t {
+    uint32_t windowUs;      // time covered, since the previous Power_Report()
+    uint16_t awakePermille; // share of that time the CPU was running, 0-1000
+    uint32_t averageUa;     // estimated average MCU current over the window
+    uint16_t deepSleeps;    // Power_DeepSleep() calls in the window, their time isn't in windowUs
+};
+
+void Power_Sleep(void);
+void Power_DeepSleep(void);
+void Power_Report(struct power_report_t *report);
@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include "msp.h"
+#include "profile.h"
+#include "format.h"
+#include "../inc/Clock.h"
+
+#define PROFILE_LINE_BYTES  56  // longest name, 4 ten digit numbers, commas and \r\n
+
+static struct profile_stat_t stats[PROFILE_SCOPES];
+static uint32_t cyclesPerUs = 48;
+
+static const char *const names[PROFILE_SCOPES] = {
+    "spi isr", "spi fg", "dispbuf", "swap", "char", "bufchar", "bufrun", "note",
+    "accel", "gyro", "mag", "temp", "orient", "cal", "profile"
+};
+
+// starts the cycle counter, safe to call again (Fusion_Init() turns it on as well)
+void Profile_Init(void){
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    cyclesPerUs = Clock_GetFreq() / 1000000;
+    Profile_Reset();
+}
+
+void Profile_Reset(void){
+    uint8_t i;
+
+    for (i = 0; i < PROFILE_SCOPES; i++) {
+        stats[i].count = 0;
+        stats[i].minCycles = 0;
+        stats[i].maxCycles = 0;
+        stats[i].totalCycles = 0;
+    }
+}
+
+// a scope must only be recorded from one priority level, the update isn't atomic
+void Profile_Record(enum profile_scope_t scope, uint32_t cycles){
+    struct profile_stat_t *stat = &stats[scope];
+
+    if ((stat->count == 0) || (cycles < stat->minCycles)) {
+        stat->minCycles = cycles;
+    }
+    if (cycles > stat->maxCycles) {
+        stat->maxCycles = cycles;
+    }
+    stat->totalCycles += cycles;
+    stat->count++;
+}
+
+void Profile_Get(enum profile_scope_t scope, struct profile_stat_t *stat){
+    *stat = stats[scope];
+}
+
+const char *Profile_Name(enum profile_scope_t scope){
+    return names[scope];
+}
+
+uint32_t Profile_CyclesToUs(uint32_t cycles){
+    return cycles / cyclesPerUs;
+}
+
+uint16_t Profile_Print(char *out, uint16_t size){
+    char *end = out;
+    const char *name;
+    uint8_t i;
+
+    for (i = 0; (i < PROFILE_SCOPES) && ((end - out) + PROFILE_LINE_BYTES <= size); i++) {
+        if (stats[i].count == 0) {
+            continue;
+        }
+        for (name = names[i]; *name; name++) {
+            *end++ = *name;
+        }
+        *end++ = ',';
+        end = Format_PutDecimal(end, stats[i].count);
+        *end++ = ',';
+        end = Format_PutDecimal(end, stats[i].minCycles);
+        *end++ = ',';
+        end = Format_PutDecimal(end, (uint32_t)(stats[i].totalCycles / stats[i].count));
+        *end++ = ',';
+        end = Format_PutDecimal(end, stats[i].maxCycles);
+        *end++ = '\r';
+        *end++ = '\n';
+    }
+    return (uint16_t)(end - out);
+}
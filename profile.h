@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include "msp.h"
+
+// Cycle counts per named scope from the Cortex-M4 DWT cycle counter (CYCCNT, one count per MCLK
+// cycle, 48 per us). Unlike the calibrated loops in Clock.c these don't drift with compiler
+// settings or wait states. A scope is timed with
+//   uint32_t start = PROFILE_START();
+//   ...
+//   PROFILE_STOP(PROFILE_PLAY_NOTE, start);
+// and keeps min/avg/max over every pass since Profile_Reset(). Counts include time spent in any
+// interrupt that preempted the scope. Build with PROFILE_ENABLED 0 to compile the markers out.
+
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED 1
+#endif
+
+// the PROFILE_STATE scopes are one per final_main.c state, in enum states order
+enum profile_scope_t {
+    PROFILE_READ_SPI_ISR,   // devRead() from PORT6_IRQHandler, one sensor transaction
+    PROFILE_READ_SPI_MAIN,  // devRead() from the main loop (setup, calibration, bus checks)
+    PROFILE_DISPLAY_BUFFER, // SSD1306_DisplayBuffer(), one whole frame handed out
+    PROFILE_SWAP_BUFFERS,   // SSD1306_SwapBuffers(), the dirty window of a frame handed out
+    PROFILE_OUT_CHAR,       // SSD1306_OutChar(), one character straight to the display
+    PROFILE_BUF_OUT_CHAR,   // SSD1306_BufOutChar(), one character into the RAM buffer
+    PROFILE_BUF_OUT_RUN,    // SSD1306_BufOutRun(), one run of characters into the RAM buffer
+    PROFILE_PLAY_NOTE,      // play_note(), queueing a beep
+    PROFILE_STATE_ACCELEROMETER,
+    PROFILE_STATE_GYROSCOPE,
+    PROFILE_STATE_MAGNETOMETER,
+    PROFILE_STATE_THERMOMETER,
+    PROFILE_STATE_ORIENTATION,
+    PROFILE_STATE_CALIBRATION,
+    PROFILE_STATE_PROFILER,
+    PROFILE_SCOPES
+};
+#define PROFILE_STATE PROFILE_STATE_ACCELEROMETER
+
+struct profile_stat_t {
+    uint32_t count;         // passes recorded
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;   // for the average, doesn't overflow for 12000 years at 48 MHz
+};
+
+#if PROFILE_ENABLED
+#define PROFILE_START()             (DWT->CYCCNT)
+#define PROFILE_STOP(scope, start)  Profile_Record((scope), DWT->CYCCNT - (start))
+#else
+#define PROFILE_START()             0
+#define PROFILE_STOP(scope, start)  ((void)(start))
+#endif
+
+void Profile_Init(void);
+void Profile_Reset(void);
+void Profile_Record(enum profile_scope_t scope, uint32_t cycles);
+void Profile_Get(enum profile_scope_t scope, struct profile_stat_t *stat);
+const char *Profile_Name(enum profile_scope_t scope);
+uint32_t Profile_CyclesToUs(uint32_t cycles);
+
+// "name,count,min,avg,max\r\n" in cycles for every scope that has run, returns the length written
+uint16_t Profile_Print(char *out, uint16_t size);
@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Fixed size single producer/single consumer ring, typically an ISR putting and the main loop getting.
+// RING_DEFINE(name, type, size) declares struct name_t and name_Put/Get/Count/Clear for it.
+// size must be a power of two (checked at compile time) up to 32768.
+//
+// head is only written by the producer and tail only by the consumer, both free running and masked
+// on use, so neither side needs StartCritical()/EndCritical() on the single core M4. The slots are
+// volatile so the compiler can't move the copy of an item past the index store that publishes it.
+// A full ring drops the new item (the producer can't touch tail) and counts it in dropped.
+//
+// usage:
+//   RING_DEFINE(sampleRing, struct imu_sample_t, 32)
+//   struct sampleRing_t samples;       // zeroed (empty) like any other global
+//   sampleRing_Put(&samples, &s);      // in the ISR
+//   while (sampleRing_Get(&samples, &s)) {...}   // in main
+#define RING_DEFINE(name, type, size)                                                       \
+    typedef char name##_size_is_a_power_of_two[(((size) & ((size) - 1)) == 0) ? 1 : -1];    \
+    struct name##_t {                                                                       \
+        volatile type data[size];                                                           \
+        volatile uint16_t head;     /* next slot to put, producer only */                   \
+        volatile uint16_t tail;     /* next slot to get, consumer only */                   \
+        volatile uint16_t dropped;  /* puts refused because the ring was full */            \
+    };                                                                                      \
+    static inline uint16_t name##_Count(const struct name##_t *ring){                       \
+        return (uint16_t)(ring->head - ring->tail);                                         \
+    }                                                                                       \
+    static inline bool name##_Put(struct name##_t *ring, const type *item){                 \
+        uint16_t head = ring->head;                                                         \
+        if ((uint16_t)(head - ring->tail) >= (size)) {                                      \
+            ring->dropped++;                                                                \
+            return false;                                                                   \
+        }                                                                                   \
+        ring->data[head & ((size) - 1)] = *item;                                            \
+        ring->head = head + 1;      /* publish only after the copy */                       \
+        return true;                                                                        \
+    }                                                                                       \
+    static inline bool name##_Get(struct name##_t *ring, type *item){                       \
+        uint16_t tail = ring->tail;                                                         \
+        if (tail == ring->head) {                                                           \
+            return false;                                                                   \
+        }                                                                                   \
+        *item = ring->data[tail & ((size) - 1)];                                            \
+        ring->tail = tail + 1;      /* free the slot only after the copy */                 \
+        return true;                                                                        \
+    }                                                                                       \
+    /* consumer side only */                                                                \
+    static inline void name##_Clear(struct name##_t *ring){                                 \
+        ring->tail = ring->head;                                                            \
+    }
@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "msp.h"
+#include "scheduler.h"
+#include "../inc/Clock.h"
+#include "../inc/CortexM.h"
+
+struct task_t {
+    task_fn_t fn;       // 0 when the slot is free
+    uint32_t period;    // ms, 0 for a one-shot
+    uint32_t due;       // Scheduler_Millis() value it runs at
+};
+
+static struct task_t tasks[SCHEDULER_MAX_TASKS];
+static volatile uint32_t msTicks;
+static uint32_t cyclesPerMs;
+
+void SysTick_Handler(void){
+    msTicks++;
+}
+
+// SysTick from the core clock at 1 kHz, lowest priority so it never delays the sensor or DMA handlers
+void Scheduler_Init(void){
+    cyclesPerMs = Clock_GetFreq() / 1000;
+    SysTick->CTRL = 0;
+    SysTick->LOAD = cyclesPerMs - 1;
+    SysTick->VAL = 0;
+    NVIC_SetPriority(SysTick_IRQn, 7);
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+uint32_t Scheduler_Millis(void){
+    return msTicks;
+}
+
+// ms ticks plus how far SysTick has counted down into the current one. also right with interrupts
+// masked (e.g. just after a WFI wake) as long as they haven't been masked for more than half a ms
+// past a wrap: a pending tick that SysTick_Handler hasn't counted yet is added in here
+uint32_t Scheduler_Micros(void){
+    uint32_t ms, val;
+    bool pending;
+    do {
+        ms = msTicks;
+        val = SysTick->VAL;
+        pending = (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) != 0;
+    } while (ms != msTicks);    // SysTick_Handler ran in between, read again
+    if (pending && (val > (cyclesPerMs / 2))) {
+        ms++;                   // wrapped just now, the handler is still waiting to run
+    }
+    return (ms * 1000) + ((cyclesPerMs - 1 - val) * 1000) / cyclesPerMs;
+}
+
+static int8_t addTask(task_fn_t task, uint32_t periodMs, uint32_t delayMs){
+    int8_t i;
+    for (i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        if (tasks[i].fn == 0) {
+            tasks[i].period = periodMs;
+            tasks[i].due = msTicks + delayMs;
+            tasks[i].fn = task;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int8_t Scheduler_AddPeriodic(task_fn_t task, uint32_t periodMs){
+    return addTask(task, periodMs, periodMs);
+}
+
+int8_t Scheduler_AddOneShot(task_fn_t task, uint32_t delayMs){
+    return addTask(task, 0, delayMs);
+}
+
+void Scheduler_Cancel(int8_t id){
+    if ((id >= 0) && (id < SCHEDULER_MAX_TASKS)) {
+        tasks[id].fn = 0;
+    }
+}
+
+void Scheduler_Run(void){
+    uint8_t i;
+    uint32_t now;
+    task_fn_t fn;
+
+    for (i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        now = msTicks;
+        fn = tasks[i].fn;
+        if ((fn == 0) || ((int32_t)(now - tasks[i].due) < 0)) {
+            continue;
+        }
+        if (tasks[i].period == 0) {
+            tasks[i].fn = 0;    // free the slot first so the task can schedule itself again
+        } else {
+            tasks[i].due += tasks[i].period;
+            if ((int32_t)(now - tasks[i].due) >= 0) {
+                tasks[i].due = now + tasks[i].period;   // fell more than a period behind, skip instead of bursting
+            }
+        }
+        fn();
+    }
+}
+
+// true if Scheduler_Run() has something to do right now
+bool Scheduler_Due(void){
+    uint8_t i;
+    uint32_t now = msTicks;
+
+    for (i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+        if ((tasks[i].fn != 0) && ((int32_t)(now - tasks[i].due) >= 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler_Sleep(uint32_t ms){
+    uint32_t start = msTicks;
+    while ((msTicks - start) < ms) {
+        WaitForInterrupt();     // next SysTick at the latest
+    }
+}
@@ -0,0 +1,30 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+// Cooperative scheduler on a 1 ms SysTick. SysTick_Handler only counts milliseconds; tasks run to
+// completion from Scheduler_Run() in the main loop, so they never preempt each other or the main loop
+// and can use the drivers freely. Keep them short, a slow task delays every task behind it.
+
+#define SCHEDULER_MAX_TASKS 8
+
+typedef void (*task_fn_t)(void);
+
+void Scheduler_Init(void);
+
+// both are free running and wrap, Scheduler_Millis() every 2^32 ms (49.7 days) and Scheduler_Micros()
+// every 2^32 us (71.6 minutes). Take times as differences, now - start on uint32_t is right across a
+// wrap for spans shorter than that, and never compare two absolute values for before/after
+uint32_t Scheduler_Millis(void);
+uint32_t Scheduler_Micros(void);
+
+// both return a task id for Scheduler_Cancel(), or -1 if all SCHEDULER_MAX_TASKS slots are in use
+int8_t Scheduler_AddPeriodic(task_fn_t task, uint32_t periodMs);   // first run one period from now
+int8_t Scheduler_AddOneShot(task_fn_t task, uint32_t delayMs);     // runs once, then frees its slot
+void Scheduler_Cancel(int8_t id);
+
+// runs every task that is due, call it each time the main loop wakes
+void Scheduler_Run(void);
+bool Scheduler_Due(void);
+
+// sleeps (WFI) for ms without running tasks, for init code before the main loop
+void Scheduler_Sleep(uint32_t ms);
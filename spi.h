@@ -0,0 +1,178 @@
+#ifndef SPI_H
+#define SPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "msp.h"
+#include "../inc/CortexM.h"
+#include "dma.h"
+
+// SPI transaction engine for the eUSCI_A/B masters, one instance per bus built at compile time.
+// SPI_DEFINE(name, base) declares name_Submit/Run/Idle (and the name_Send/Receive/Flush byte movers
+// under them) for the eUSCI at base, e.g. EUSCI_B1. SPI_DEFINE_DMA(name, base, txDma) also moves tx
+// parts of SPI_DMA_MIN bytes or more with the uDMA channel/trigger pair txDma (see dma.h), and then
+// the channel's DMA_INTn_IRQHandler has to call DMA_ClearFlag() and name_DMADone().
+// Put the instance in the driver that owns the bus, everything it makes is static to that file.
+//
+// A transaction asserts its CS and DC pins, sends the header byte and the tx part, receives the rx
+// part and releases CS, then calls done. Submitted transactions run in order: the first one right away
+// in name_Submit(), the rest as the ones before them finish (from the DMA interrupt when one is on
+// the DMA). Bytes are fed on TXIFG rather than waiting for BUSY after each one, so the eUSCI's double
+// buffered TXBUF keeps the clock running back to back; BUSY is only waited for before the pins change.
+// Receiving holds interrupts off for the burst so a late RXBUF read can't overrun.
+//
+// usage:
+//   SPI_DEFINE(sensorBus, EUSCI_B1)
+//   struct spi_txn_t txn = {&P6OUT, BIT0};   // CS on P6.0, the rest 0
+//   txn.header = address | 0x80; txn.headerLength = 1; txn.rx = data; txn.rxCount = 6;
+//   sensorBus_Run(&txn);                     // back with data filled in
+#define SPI_FILL        0x00    // sent while receiving
+#define SPI_DMA_MIN     8       // shorter tx parts aren't worth setting the DMA up for
+#define SPI_IFG_RX      0x01    // UCRXIFG, the same bit on eUSCI_A and eUSCI_B
+#define SPI_IFG_TX      0x02    // UCTXIFG
+#define SPI_STATW_BUSY  0x01    // UCBUSY
+
+struct spi_txn_t {
+    volatile uint8_t *csPort;   // chip select output (e.g. &P6OUT), 0 when the eUSCI's STE pin does it
+    uint8_t csMask;             // pins driven low for the transaction and high again after
+    volatile uint8_t *dcPort;   // data/command output, 0 for none
+    uint8_t dcMask;
+    uint8_t dc;                 // true drives dcMask high (data), false low (command)
+    uint8_t headerLength;       // 0 or 1
+    uint8_t header;             // sent first, e.g. a register address
+    const uint8_t *tx;          // then txCount bytes from here, what comes back is dropped
+    uint16_t txCount;
+    uint8_t *rx;                // then rxCount SPI_FILL bytes, what comes back lands here
+    uint16_t rxCount;
+    void (*done)(struct spi_txn_t *txn);    // once CS is released, from where the engine ran. may submit more
+    struct spi_txn_t *next;     // engine only, the queue
+    volatile uint8_t busy;      // engine only, true from name_Submit() until done
+};
+
+// SPI_DEFINE passes no channel or trigger (0, 0, never used). txDma arrives as two arguments, an argument
+// is expanded before it is substituted, so dma.h pairs are "channel, trigger" by the time this sees them
+#define SPI_DEFINE(name, base)              SPI_DEFINE_ENGINE(name, base, 0, 0, 0)
+#define SPI_DEFINE_DMA(name, base, txDma)   SPI_DEFINE_ENGINE(name, base, 1, txDma)
+
+#define SPI_DEFINE_ENGINE(name, base, useDma, txChannel, txTrigger)                             \
+    static struct spi_txn_t *name##_head;   /* running or next up, 0 when idle */              \
+    static struct spi_txn_t *name##_tail;                                                       \
+    static uint8_t name##_pumping;          /* a name_Pump() is on the stack */                 \
+    /* waits for the last byte to shift out and drops what came back with it */                \
+    static inline void name##_Flush(void){                                                      \
+        while ((base)->STATW & SPI_STATW_BUSY) {}                                               \
+        (void)(base)->RXBUF;                /* clears RXIFG and the overrun flag */             \
+    }                                                                                           \
+    /* returns with the last byte possibly still in TXBUF, name_Flush() before a pin changes */ \
+    static inline void name##_Send(const uint8_t *tx, uint16_t count){                          \
+        uint16_t i;                                                                             \
+        for (i = 0; i < count; i++) {                                                           \
+            while (((base)->IFG & SPI_IFG_TX) == 0) {}                                          \
+            (base)->TXBUF = tx[i];                                                              \
+        }                                                                                       \
+    }                                                                                           \
+    /* one byte ahead in TXBUF while the previous one shifts, so at most two are in flight */   \
+    static inline void name##_Receive(uint8_t *rx, uint16_t count){                             \
+        uint16_t sent = 1, got = 0;                                                             \
+        long sr;                                                                                \
+        if (count == 0) {                                                                       \
+            return;                                                                             \
+        }                                                                                       \
+        name##_Flush();                                                                         \
+        sr = StartCritical();                                                                   \
+        (base)->TXBUF = SPI_FILL;                                                               \
+        while (got < count) {                                                                   \
+            if ((sent < count) && ((base)->IFG & SPI_IFG_TX)) {                                 \
+                (base)->TXBUF = SPI_FILL;                                                       \
+                sent++;                                                                         \
+            }                                                                                   \
+            if ((base)->IFG & SPI_IFG_RX) {                                                     \
+                rx[got++] = (base)->RXBUF;                                                      \
+            }                                                                                   \
+        }                                                                                       \
+        EndCritical(sr);                                                                        \
+    }                                                                                           \
+    static inline void name##_Begin(struct spi_txn_t *txn){                                     \
+        if (txn->dcPort != 0) {                                                                 \
+            *txn->dcPort = txn->dc ? (*txn->dcPort | txn->dcMask) : (*txn->dcPort & ~txn->dcMask); \
+        }                                                                                       \
+        if (txn->csPort != 0) {                                                                 \
+            *txn->csPort &= ~txn->csMask;                                                       \
+        }                                                                                       \
+        name##_Send(&txn->header, txn->headerLength);                                           \
+    }                                                                                           \
+    /* the rx part, release, unlink, then done */                                               \
+    static inline void name##_Complete(struct spi_txn_t *txn){                                  \
+        long sr;                                                                                \
+        name##_Receive(txn->rx, txn->rxCount);                                                  \
+        name##_Flush();                                                                         \
+        if (txn->csPort != 0) {                                                                 \
+            *txn->csPort |= txn->csMask;                                                        \
+        }                                                                                       \
+        sr = StartCritical();                                                                   \
+        name##_head = txn->next;                                                                \
+        if (name##_head == 0) {                                                                 \
+            name##_tail = 0;                                                                    \
+        }                                                                                       \
+        EndCritical(sr);                                                                        \
+        txn->busy = false;                                                                      \
+        if (txn->done != 0) {                                                                   \
+            txn->done(txn);                                                                     \
+        }                                                                                       \
+    }                                                                                           \
+    /* runs the queue until it is empty or a transaction is left to the DMA */                  \
+    static inline void name##_Pump(void){                                                       \
+        struct spi_txn_t *txn;                                                                  \
+        name##_pumping = true;                                                                  \
+        while ((txn = name##_head) != 0) {                                                      \
+            name##_Begin(txn);                                                                  \
+            if ((useDma) && (txn->txCount >= SPI_DMA_MIN)) {                                    \
+                DMA_StartTx(txChannel, txTrigger, txn->tx, &(base)->TXBUF, txn->txCount);       \
+                break;                      /* name_DMADone() carries on */                     \
+            }                                                                                   \
+            name##_Send(txn->tx, txn->txCount);                                                 \
+            name##_Complete(txn);                                                               \
+        }                                                                                       \
+        name##_pumping = false;                                                                 \
+    }                                                                                           \
+    /* queues txn and starts it if the bus is idle. txn has to stay put until it is done */     \
+    static inline void name##_Submit(struct spi_txn_t *txn){                                    \
+        bool start;                                                                             \
+        long sr;                                                                                \
+        txn->next = 0;                                                                          \
+        txn->busy = true;                                                                       \
+        sr = StartCritical();                                                                   \
+        start = (name##_head == 0) && !name##_pumping;                                          \
+        if (name##_tail != 0) {                                                                 \
+            name##_tail->next = txn;                                                            \
+        } else {                                                                                \
+            name##_head = txn;                                                                  \
+        }                                                                                       \
+        name##_tail = txn;                                                                      \
+        EndCritical(sr);                                                                        \
+        if (start) {                                                                            \
+            name##_Pump();                                                                      \
+        }                                                                                       \
+    }                                                                                           \
+    /* name_Submit() and wait. from an interrupt only if nothing it preempts can be using the bus */ \
+    static inline void name##_Run(struct spi_txn_t *txn){                                       \
+        name##_Submit(txn);                                                                     \
+        while (txn->busy) {}                                                                    \
+    }                                                                                           \
+    /* from the DMA_INTn_IRQHandler of txChannel: the tx part has been loaded into TXBUF.   \
+       name_Flush() in name_Complete() spins here on the two bytes still in the eUSCI       \
+       (TXBUF and the shift register, 16 bit clocks) before CS is released, then            \
+       name_Pump() polls out any short transactions queued behind it. the eUSCI has no      \
+       end of transfer interrupt in SPI mode to hand the wait to, keep the clock fast */    \
+    static inline void name##_DMADone(void){                                                    \
+        if (name##_head != 0) {                                                                 \
+            name##_pumping = true;          /* done may submit, leave it to the pump below */   \
+            name##_Complete(name##_head);                                                       \
+            name##_Pump();                                                                      \
+        }                                                                                       \
+    }                                                                                           \
+    static inline bool name##_Idle(void){                                                       \
+        return name##_head == 0;                                                                \
+    }
+
+#endif
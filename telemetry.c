@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "msp.h"
+#include "dma.h"
+#include "telemetry.h"
+#include "format.h"
+
+#define TELEMETRY_DMA_CH    0           // uDMA channel 0 is triggered by eUSCI_A0 TX
+#define SYNC0               0xA5
+#define SYNC1               0x5A
+#define ASCII_LINE_BYTES    82          // 10 digit time, 10 ",-32768" and \r\n
+#define FRAME_NONE          -1
+
+// SMCLK 12 MHz, 16x oversampling (user's guide table 24-5)
+#define BINARY_BRW          1           // 460800: N = 26.04
+#define BINARY_MCTLW        ((0x00 << 8) | (10 << 4) | EUSCI_A_MCTLW_OS16)
+#define ASCII_BRW           6           // 115200: N = 104.17
+#define ASCII_MCTLW         ((0x20 << 8) | (8 << 4) | EUSCI_A_MCTLW_OS16)
+
+static uint8_t frames[2][TELEMETRY_FRAME_BYTES];
+static uint16_t frameLength[2];
+static volatile int8_t sending = FRAME_NONE;    // frame the DMA is shifting out
+static volatile int8_t queued = FRAME_NONE;     // frame built and waiting for the DMA
+static enum telemetry_format_t telemetryFormat;
+static uint8_t sequence;
+static uint32_t dropped;
+
+// CRC-16/CCITT a nibble at a time, the same CRC as flash_store.c but fast enough for the full stream
+static const uint16_t crcNibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static uint16_t crc16(const uint8_t *data, uint16_t length){
+    uint16_t crc = 0xFFFF;
+    uint16_t i;
+
+    for (i = 0; i < length; i++) {
+        crc = (crc << 4) ^ crcNibble[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crcNibble[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+};
+
+// DMA_INT2 stays off while the main loop looks at or changes sending/queued
+static void lock(void){
+    NVIC->ICER[DMA_INT2_IRQn >> 5] = (1 << (DMA_INT2_IRQn & 0x1F));
+};
+
+static void unlock(void){
+    NVIC->ISER[DMA_INT2_IRQn >> 5] = (1 << (DMA_INT2_IRQn & 0x1F));
+};
+
+static void startFrame(int8_t frame){
+    sending = frame;
+    DMA_StartTx(DMA_CH0_EUSCIA0TX, frames[frame], &EUSCI_A0->TXBUF, frameLength[frame]);
+};
+
+void Telemetry_Init(enum telemetry_format_t format){
+    telemetryFormat = format;
+    EUSCI_A0->CTLW0 = EUSCI_A_CTLW0_SWRST;                          // hold in reset while configuring
+    EUSCI_A0->CTLW0 = EUSCI_A_CTLW0_SWRST | EUSCI_A_CTLW0_SSEL__SMCLK;  // 8N1, LSB first
+    if (format == TELEMETRY_BINARY) {
+        EUSCI_A0->BRW = BINARY_BRW;
+        EUSCI_A0->MCTLW = BINARY_MCTLW;
+    } else {
+        EUSCI_A0->BRW = ASCII_BRW;
+        EUSCI_A0->MCTLW = ASCII_MCTLW;
+    }
+    P1->SEL0 |= (BIT2 | BIT3);      // P1.2 UCA0RXD, P1.3 UCA0TXD
+    P1->SEL1 &= ~(BIT2 | BIT3);
+    EUSCI_A0->CTLW0 &= ~EUSCI_A_CTLW0_SWRST;
+    EUSCI_A0->IE = 0;               // the DMA takes UCTXIFG, no UART interrupts
+
+    DMA_Init();
+    DMA_EnableInterrupt(2, TELEMETRY_DMA_CH);   // frame done goes to DMA_INT2_IRQHandler
+};
+
+// low 7 bits first, returns the new end of the frame
+static uint8_t *putVarint(uint8_t *out, uint32_t value){
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+};
+
+// zig-zag maps small negative and positive deltas alike to small values, 0 -1 1 -2 2 to 0 1 2 3 4
+static uint8_t *putDelta(uint8_t *out, int32_t delta){
+    return putVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+};
+
+// builds one binary frame from up to TELEMETRY_FRAME_SAMPLES samples, returns how many it took
+static uint16_t buildBinary(uint8_t *frame, uint16_t *length, const struct imu_sample_t *samples, uint16_t count){
+    const int16_t *axes, *previous = 0;
+    uint8_t *out = frame;
+    uint16_t crc, i;
+    uint8_t c;
+
+    if (count > TELEMETRY_FRAME_SAMPLES) {
+        count = TELEMETRY_FRAME_SAMPLES;
+    }
+    *out++ = SYNC0;
+    *out++ = SYNC1;
+    *out++ = sequence++;
+    *out++ = (uint8_t)count;
+    *out++ = (uint8_t)samples[0].time;
+    *out++ = (uint8_t)(samples[0].time >> 8);
+    *out++ = (uint8_t)(samples[0].time >> 16);
+    *out++ = (uint8_t)(samples[0].time >> 24);
+    for (i = 0; i < count; i++) {
+        axes = (const int16_t *)&samples[i];    // IMU_CHANNELS int16_t in struct order
+        out = putVarint(out, (i == 0) ? 0 : samples[i].time - samples[i - 1].time);
+        for (c = 0; c < IMU_CHANNELS; c++) {
+            out = putDelta(out, (int32_t)axes[c] - ((previous != 0) ? previous[c] : 0));
+        }
+        previous = axes;
+    }
+    crc = crc16(frame + 2, (uint16_t)(out - frame - 2));
+    *out++ = (uint8_t)crc;
+    *out++ = (uint8_t)(crc >> 8);
+    *length = (uint16_t)(out - frame);
+    return count;
+};
+
+// as many lines as fit in one frame buffer, returns how many samples it took
+static uint16_t buildAscii(uint8_t *frame, uint16_t *length, const struct imu_sample_t *samples, uint16_t count){
+    const int16_t *axes;
+    char *out = (char *)frame;
+    uint16_t i;
+    uint8_t c;
+
+    for (i = 0; (i < count) && ((out - (char *)frame) + ASCII_LINE_BYTES <= TELEMETRY_FRAME_BYTES); i++) {
+        axes = (const int16_t *)&samples[i];
+        out = Format_PutDecimal(out, samples[i].time);
+        for (c = 0; c < IMU_CHANNELS; c++) {
+            *out++ = ',';
+            if (axes[c] < 0) {
+                *out++ = '-';
+            }
+            out = Format_PutDecimal(out, (axes[c] < 0) ? -(int32_t)axes[c] : axes[c]);
+        }
+        *out++ = '\r';
+        *out++ = '\n';
+    }
+    *length = (uint16_t)(out - (char *)frame);
+    return i;
+};
+
+// a frame that is neither sending nor queued is free to build in, the ISR only ever lets go of frames
+static int8_t claimFrame(void){
+    int8_t frame;
+
+    lock();
+    frame = ((sending != 0) && (queued != 0)) ? 0 : (((sending != 1) && (queued != 1)) ? 1 : FRAME_NONE);
+    unlock();
+    return frame;
+};
+
+static void queueFrame(int8_t frame){
+    lock();
+    if (sending == FRAME_NONE) {
+        startFrame(frame);
+    } else {
+        queued = frame;
+    }
+    unlock();
+};
+
+uint16_t Telemetry_Send(const struct imu_sample_t *samples, uint16_t count){
+    uint16_t sent = 0;
+    int8_t frame;
+
+    while (sent < count) {
+        frame = claimFrame();
+        if (frame == FRAME_NONE) {
+            dropped += count - sent;
+            break;
+        }
+        if (telemetryFormat == TELEMETRY_BINARY) {
+            sent += buildBinary(frames[frame], &frameLength[frame], &samples[sent], count - sent);
+        } else {
+            sent += buildAscii(frames[frame], &frameLength[frame], &samples[sent], count - sent);
+        }
+        queueFrame(frame);
+    }
+    return sent;
+};
+
+bool Telemetry_SendText(const char *text, uint16_t length){
+    int8_t frame = claimFrame();
+    uint16_t i;
+
+    if ((frame == FRAME_NONE) || (length == 0) || (length > TELEMETRY_FRAME_BYTES)) {
+        return false;
+    }
+    for (i = 0; i < length; i++) {
+        frames[frame][i] = (uint8_t)text[i];
+    }
+    frameLength[frame] = length;
+    queueFrame(frame);
+    return true;
+};
+
+uint32_t Telemetry_Dropped(void){
+    return dropped;
+};
+
+bool Telemetry_Busy(void){
+    return (sending != FRAME_NONE) || (queued != FRAME_NONE) || (EUSCI_A0->STATW & EUSCI_A_STATW_BUSY);
+};
+
+// telemetry DMA channel done: the last byte is in TXBUF, start the frame waiting behind it
+void DMA_INT2_IRQHandler(void){
+    DMA_ClearFlag(TELEMETRY_DMA_CH);
+    sending = FRAME_NONE;
+    if (queued != FRAME_NONE) {
+        startFrame(queued);
+        queued = FRAME_NONE;
+    }
+};
@@ -0,0 +1,43 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "LSM9DS1.h"
+
+// Sample streaming over the LaunchPad's backchannel UART (eUSCI_A0, P1.2 RX / P1.3 TX, the XDS110
+// virtual COM port). Frames are built in the main loop and sent by uDMA channel 0, two frame buffers
+// deep so the next one can be built while the last one is still going out.
+//
+// TELEMETRY_BINARY, 460800 baud 8N1 (46080 bytes/s). little endian, frame:
+//   0xA5 0x5A      sync
+//   seq            uint8_t, +1 per frame, a gap means frames were dropped
+//   count          uint8_t, samples in the frame, 1-TELEMETRY_FRAME_SAMPLES
+//   time           uint32_t, us timestamp of the first sample (Scheduler_Micros(), wraps every 71.6 minutes)
+//   count times:   dt, us since the previous sample (0 for the first)
+//                  temp gx gy gz ax ay az mx my mz, raw LSB minus the previous sample's (0 for the first)
+//   crc            uint16_t CRC-16/CCITT (0xFFFF start) over seq to the end of the last sample
+// dt is a varint (7 bits a byte, low first, bit 7 set on all but the last byte), the axis deltas are
+// zig-zag varints, so a quiet axis costs 1 byte. a full 952Hz AG stream is about 20 KB/s, the worst
+// case (every delta 3 bytes) 34 KB/s. frames are self contained, a lost one doesn't break the next.
+//
+// TELEMETRY_ASCII, 115200 baud 8N1, one line per sample for a terminal:
+//   time,temp,gx,gy,gz,ax,ay,az,mx,my,mz\r\n
+// in raw decimal LSB. only keeps up with the slower ODRs, the rest is dropped.
+
+#define TELEMETRY_FRAME_SAMPLES 16      // most samples per binary frame
+#define TELEMETRY_FRAME_BYTES   576     // enough for TELEMETRY_FRAME_SAMPLES worst case samples
+
+enum telemetry_format_t {TELEMETRY_BINARY, TELEMETRY_ASCII};
+
+void Telemetry_Init(enum telemetry_format_t format);
+
+// queues count samples in order, returns how many were taken. the rest are dropped (and counted)
+// when both frame buffers are still waiting on the UART
+uint16_t Telemetry_Send(const struct imu_sample_t *samples, uint16_t count);
+uint32_t Telemetry_Dropped(void);   // samples dropped since power up, the profiler page's last row
+
+// sends up to TELEMETRY_FRAME_BYTES of text as one frame between the sample frames, for reports
+// like Profile_Print(). a binary mode reader skips it while looking for the next sync word.
+// false if it is too long or both frame buffers are busy
+bool Telemetry_SendText(const char *text, uint16_t length);
+
+// true until the last queued byte has left the UART. SMCLK stops in LPM3, so wait for this first
+bool Telemetry_Busy(void);